@@ -0,0 +1,205 @@
+//! Measures how many nodes per second each way of going through a tree gets through, on inputs
+//! shaped like the worst cases of the dummy grammar.
+
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use std::vec::Drain;
+use tree_sitter::{Node, Parser, Tree};
+use tree_sitter_tests::{calc_visitor_by_id, CalcVisitor, CalcVisitorById};
+
+/// `((((1))))`, nested `depth` times.
+fn deep_parens(depth: usize) -> String {
+    format!("{}1{}", "(".repeat(depth), ")".repeat(depth))
+}
+
+/// `1+1+...+1`, which the left-associative `add_expr` turns into a chain `terms` deep.
+fn long_chain(terms: usize) -> String {
+    vec!["1"; terms].join("+")
+}
+
+/// A complete binary tree of alternating sums and products with `2^depth` leaves.
+fn balanced(depth: usize) -> String {
+    match depth {
+        0 => "1".to_owned(),
+        _ if depth & 1 == 0 => format!("({}+{})", balanced(depth - 1), balanced(depth - 1)),
+        _ => format!("{}*{}", balanced(depth - 1), balanced(depth - 1)),
+    }
+}
+
+fn parser() -> Parser {
+    let mut parser = Parser::new();
+    parser
+        .set_language(tree_sitter_tests::language())
+        .expect("Error loading dummy language");
+    parser
+}
+
+fn count_nodes(tree: &Tree) -> u64 {
+    let mut cursor = tree.walk();
+    let (mut nodes, mut depth) = (0, 0);
+    loop {
+        nodes += 1;
+        if cursor.goto_first_child() {
+            depth += 1;
+            continue;
+        }
+        while !cursor.goto_next_sibling() {
+            if depth == 0 {
+                return nodes;
+            }
+            cursor.goto_parent();
+            depth -= 1;
+        }
+    }
+}
+
+fn inputs() -> Vec<(&'static str, String)> {
+    vec![
+        ("deep_parens", deep_parens(2_000)),
+        ("long_chain", long_chain(20_000)),
+        ("balanced", balanced(14)),
+    ]
+}
+
+struct Calculator<'t> {
+    src: &'t str,
+}
+
+impl<'t> CalcVisitor for Calculator<'t> {
+    type ReturnType = f64;
+
+    fn visit_root(&mut self, node: &Node) -> f64 {
+        self.visit(&node.child(0).unwrap())
+    }
+
+    fn visit_number(&mut self, node: &Node) -> f64 {
+        self.src[node.byte_range()].parse().unwrap()
+    }
+
+    fn visit_add_expr(&mut self, node: &Node) -> f64 {
+        self.visit(&node.child_by_field_name("lhs").unwrap())
+            + self.visit(&node.child_by_field_name("rhs").unwrap())
+    }
+
+    fn visit_mul_expr(&mut self, node: &Node) -> f64 {
+        self.visit(&node.child_by_field_name("lhs").unwrap())
+            * self.visit(&node.child_by_field_name("rhs").unwrap())
+    }
+
+    fn visit_paren_expr(&mut self, node: &Node) -> f64 {
+        self.visit(&node.child_by_field_name("body").unwrap())
+    }
+
+    fn fold_root(&mut self, _node: &Node, mut children: Drain<f64>) -> f64 {
+        children.next().unwrap()
+    }
+
+    fn fold_number(&mut self, node: &Node, _children: Drain<f64>) -> f64 {
+        self.src[node.byte_range()].parse().unwrap()
+    }
+
+    fn fold_add_expr(&mut self, _node: &Node, children: Drain<f64>) -> f64 {
+        children.sum()
+    }
+
+    fn fold_mul_expr(&mut self, _node: &Node, children: Drain<f64>) -> f64 {
+        children.product()
+    }
+
+    fn fold_paren_expr(&mut self, _node: &Node, mut children: Drain<f64>) -> f64 {
+        children.next().unwrap()
+    }
+}
+
+struct IdCalculator<'t> {
+    src: &'t str,
+}
+
+impl<'t> CalcVisitorById for IdCalculator<'t> {
+    type ReturnType = f64;
+
+    fn visit_root(&mut self, node: &Node) -> f64 {
+        self.visit(&node.child(0).unwrap())
+    }
+
+    fn visit_number(&mut self, node: &Node) -> f64 {
+        self.src[node.byte_range()].parse().unwrap()
+    }
+
+    fn visit_add_expr(&mut self, node: &Node) -> f64 {
+        self.visit(&calc_visitor_by_id::add_expr_lhs(node).unwrap())
+            + self.visit(&calc_visitor_by_id::add_expr_rhs(node).unwrap())
+    }
+
+    fn visit_mul_expr(&mut self, node: &Node) -> f64 {
+        self.visit(&calc_visitor_by_id::mul_expr_lhs(node).unwrap())
+            * self.visit(&calc_visitor_by_id::mul_expr_rhs(node).unwrap())
+    }
+
+    fn visit_paren_expr(&mut self, node: &Node) -> f64 {
+        self.visit(&calc_visitor_by_id::paren_expr_body(node).unwrap())
+    }
+}
+
+#[derive(Default)]
+struct Counter {
+    numbers: usize,
+}
+
+impl CalcVisitor for Counter {
+    type ReturnType = ();
+
+    fn enter_number(&mut self, _node: &Node) {
+        self.numbers += 1;
+    }
+}
+
+fn bench_parse(c: &mut Criterion) {
+    let mut group = c.benchmark_group("parse");
+    let mut parser = parser();
+    for (name, src) in inputs() {
+        let tree = parser.parse(&src, None).unwrap();
+        group.throughput(Throughput::Elements(count_nodes(&tree)));
+        group.bench_with_input(BenchmarkId::from_parameter(name), &src, |b, src| {
+            b.iter(|| parser.parse(src, None).unwrap())
+        });
+    }
+    group.finish();
+}
+
+fn bench_traversal(c: &mut Criterion) {
+    let mut group = c.benchmark_group("traversal");
+    let mut parser = parser();
+    for (name, src) in inputs() {
+        let tree = parser.parse(&src, None).unwrap();
+        let root = tree.root_node();
+        group.throughput(Throughput::Elements(count_nodes(&tree)));
+
+        group.bench_with_input(BenchmarkId::new("visit", name), &root, |b, root| {
+            b.iter(|| Calculator { src: &src }.visit(root))
+        });
+        group.bench_with_input(
+            BenchmarkId::new("visit_by_kind_id", name),
+            &root,
+            |b, root| b.iter(|| IdCalculator { src: &src }.visit(root)),
+        );
+        group.bench_with_input(BenchmarkId::new("walk", name), &tree, |b, tree| {
+            b.iter(|| {
+                let mut counter = Counter::default();
+                counter.walk(&mut tree.walk());
+                counter.numbers
+            })
+        });
+        let mut stack = tree_sitter_tests::calc_visitor::FoldStack::new();
+        group.bench_with_input(
+            BenchmarkId::new("fold_iterative", name),
+            &root,
+            |b, root| {
+                b.iter(|| Calculator { src: &src }.fold_iterative(black_box(root), &mut stack))
+            },
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_parse, bench_traversal);
+criterion_main!(benches);
@@ -1,18 +1,32 @@
 {
   "targets": [
     {
-      "target_name": "tree_sitter_tests_binding",
+      "target_name": "tree_sitter_dummy_binding",
+      "variables": {
+        # The parsing in `parsePacked` needs the runtime, which node-tree-sitter ships.
+        "runtime": "<!(node -p \"require('path').dirname(require.resolve('tree-sitter/package.json'))\")/vendor/tree-sitter/lib",
+        # `node-gyp rebuild -- -Dlex_runs=1` turns on the loops of `src/lex_runs.h` in the lexer.
+        "lex_runs%": 0,
+      },
       "include_dirs": [
         "<!(node -e \"require('nan')\")",
+        "<(runtime)/include",
+        "<(runtime)/src",
         "src"
       ],
       "sources": [
         "bindings/node/binding.cc",
         "src/parser.c",
+        "<(runtime)/src/lib.c",
         # If your language uses an external scanner, add it here.
       ],
       "cflags_c": [
         "-std=c99",
+      ],
+      "conditions": [
+        ["lex_runs==1", {
+          "defines": ["TREE_SITTER_LEX_RUNS"],
+        }],
       ]
     }
   ]
@@ -1,6 +1,10 @@
+#include <tree_sitter/api.h>
 #include "tree_sitter/parser.h"
 #include <node.h>
 #include "nan.h"
+#include <cstring>
+#include <memory>
+#include <vector>
 
 using namespace v8;
 
@@ -8,8 +12,261 @@ extern "C" TSLanguage * tree_sitter_dummy();
 
 namespace {
 
+// Every node is packed as four `uint32_t`s, in pre-order, so the root is at 0
+// and the parent of a node always comes before it.
+const uint32_t FIELDS_PER_NODE = 4;
+const uint32_t NO_PARENT = UINT32_MAX;
+
 NAN_METHOD(New) {}
 
+// The parser of the calling thread. Parsers are not thread-safe, so the main
+// thread and each thread of the libuv pool create their own on first use and
+// keep it for as long as the thread runs. Returns null if the runtime does not
+// support the ABI version of the language.
+TSParser *ThreadParser() {
+  thread_local TSParser *parser = nullptr;
+  if (!parser) {
+    parser = ts_parser_new();
+    if (!ts_parser_set_language(parser, tree_sitter_dummy())) {
+      ts_parser_delete(parser);
+      parser = nullptr;
+    }
+  }
+  return parser;
+}
+
+// Parses `length` UTF-16 code units at `source` and appends the kind id, start
+// and end offset, and parent index of each of its nodes to `nodes`. Offsets are
+// in code units, so they index into the JavaScript string directly. Returns
+// null on success and the reason otherwise, which may be raised on any thread.
+const char *PackTree(const uint16_t *source, size_t length, std::vector<uint32_t> &nodes) {
+  TSParser *parser = ThreadParser();
+  if (!parser) {
+    return "The dummy language is incompatible with the tree-sitter runtime";
+  }
+  TSTree *tree = ts_parser_parse_string_encoding(
+    parser, nullptr, reinterpret_cast<const char *>(source),
+    length * 2, TSInputEncodingUTF16
+  );
+  if (!tree) {
+    return "Parsing failed";
+  }
+  TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+  std::vector<uint32_t> parents;
+  uint32_t parent = NO_PARENT;
+  for (;;) {
+    TSNode node = ts_tree_cursor_current_node(&cursor);
+    uint32_t index = nodes.size() / FIELDS_PER_NODE;
+    nodes.push_back(ts_node_symbol(node));
+    nodes.push_back(ts_node_start_byte(node) / 2);
+    nodes.push_back(ts_node_end_byte(node) / 2);
+    nodes.push_back(parent);
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      parents.push_back(parent);
+      parent = index;
+      continue;
+    }
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if (parents.empty()) {
+        ts_tree_cursor_delete(&cursor);
+        ts_tree_delete(tree);
+        return nullptr;
+      }
+      ts_tree_cursor_goto_parent(&cursor);
+      parent = parents.back();
+      parents.pop_back();
+    }
+  }
+}
+
+Local<Uint32Array> ToUint32Array(const std::vector<uint32_t> &nodes) {
+  size_t size = nodes.size() * sizeof(uint32_t);
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(Isolate::GetCurrent(), size);
+  if (size > 0) {
+    std::memcpy(buffer->GetBackingStore()->Data(), nodes.data(), size);
+  }
+  return Uint32Array::New(buffer, 0, nodes.size());
+}
+
+// Packs the tree of a JavaScript string, throwing an `Error` and returning false
+// if it cannot be parsed.
+bool PackTree(Isolate *isolate, Local<Value> source, std::vector<uint32_t> &nodes) {
+  String::Value text(isolate, source);
+  if (const char *error = PackTree(*text, text.length(), nodes)) {
+    Nan::ThrowError(error);
+    return false;
+  }
+  return true;
+}
+
+// Copies a string out of the JavaScript heap, for a worker thread to parse.
+std::vector<uint16_t> CopySource(Isolate *isolate, Local<Value> source) {
+  String::Value text(isolate, source);
+  return std::vector<uint16_t>(*text, *text + text.length());
+}
+
+// parsePacked(source) returns a `Uint32Array` of the tree of one string, and
+// parsePacked([source, ...]) an array of them, so that a batch of files costs
+// one call into the binding and nothing per node.
+NAN_METHOD(ParsePacked) {
+  std::vector<uint32_t> nodes;
+  if (info[0]->IsString()) {
+    if (PackTree(info.GetIsolate(), info[0], nodes)) {
+      info.GetReturnValue().Set(ToUint32Array(nodes));
+    }
+    return;
+  }
+  if (!info[0]->IsArray()) {
+    Nan::ThrowTypeError("Expected a string or an array of strings");
+    return;
+  }
+
+  Local<Array> sources = Local<Array>::Cast(info[0]);
+  Local<Array> trees = Nan::New<Array>(sources->Length());
+  for (uint32_t i = 0; i < sources->Length(); i++) {
+    Local<Value> source = Nan::Get(sources, i).ToLocalChecked();
+    if (!source->IsString()) {
+      Nan::ThrowTypeError("Expected a string or an array of strings");
+      return;
+    }
+    nodes.clear();
+    if (!PackTree(info.GetIsolate(), source, nodes)) {
+      return;
+    }
+    Nan::Set(trees, i, ToUint32Array(nodes));
+  }
+  info.GetReturnValue().Set(trees);
+}
+
+// The trees of a `parseBatchAsync` call, filled in as its workers finish. Only
+// touched on the main thread, from the workers' callbacks.
+struct Batch {
+  Batch(Local<Array> trees, Local<Function> callback, uint32_t remaining)
+    : trees(trees), callback(callback), remaining(remaining) {}
+
+  ~Batch() { trees.Reset(); }
+
+  Nan::Persistent<Array> trees;
+  Nan::Callback callback;
+  uint32_t remaining;
+  bool failed = false;
+};
+
+// Parses one source on the libuv threadpool. The result is either handed to a
+// callback of its own or stored into a batch, whose callback runs once the
+// last of its workers is done.
+class ParseWorker : public Nan::AsyncWorker {
+ public:
+  ParseWorker(std::vector<uint16_t> source, Nan::Callback *callback)
+    : Nan::AsyncWorker(callback, "tree-sitter:parseAsync"), source(std::move(source)) {}
+
+  ParseWorker(std::vector<uint16_t> source, std::shared_ptr<Batch> batch, uint32_t index)
+    : Nan::AsyncWorker(nullptr, "tree-sitter:parseBatchAsync"),
+      source(std::move(source)), batch(std::move(batch)), index(index) {}
+
+  void Execute() override {
+    if (const char *error = PackTree(source.data(), source.size(), nodes)) {
+      SetErrorMessage(error);
+    }
+    source = std::vector<uint16_t>();
+  }
+
+  void HandleOKCallback() override {
+    Nan::HandleScope scope;
+    Local<Uint32Array> tree = ToUint32Array(nodes);
+    if (!batch) {
+      Local<Value> argv[] = {Nan::Null(), tree};
+      callback->Call(2, argv, async_resource);
+      return;
+    }
+    Nan::Set(Nan::New(batch->trees), index, tree);
+    if (--batch->remaining == 0 && !batch->failed) {
+      Local<Value> argv[] = {Nan::Null(), Nan::New(batch->trees)};
+      batch->callback.Call(2, argv, async_resource);
+    }
+  }
+
+  // A batch reports the first error to its callback and drops the other trees.
+  void HandleErrorCallback() override {
+    if (!batch) {
+      Nan::AsyncWorker::HandleErrorCallback();
+      return;
+    }
+    Nan::HandleScope scope;
+    batch->remaining--;
+    if (!batch->failed) {
+      batch->failed = true;
+      Local<Value> argv[] = {Nan::Error(ErrorMessage())};
+      batch->callback.Call(1, argv, async_resource);
+    }
+  }
+
+ private:
+  std::vector<uint16_t> source;
+  std::vector<uint32_t> nodes;
+  std::shared_ptr<Batch> batch;
+  uint32_t index = 0;
+};
+
+// Calls back with no trees for an empty batch. It does no work, but going
+// through the threadpool keeps the callback asynchronous like any other batch.
+class EmptyBatchWorker : public Nan::AsyncWorker {
+ public:
+  explicit EmptyBatchWorker(Nan::Callback *callback)
+    : Nan::AsyncWorker(callback, "tree-sitter:parseBatchAsync") {}
+
+  void Execute() override {}
+
+  void HandleOKCallback() override {
+    Nan::HandleScope scope;
+    Local<Value> argv[] = {Nan::Null(), Nan::New<Array>(0)};
+    callback->Call(2, argv, async_resource);
+  }
+};
+
+// parseAsync(source, callback) parses on the libuv threadpool and calls
+// `callback(null, tree)` with the same `Uint32Array` that parsePacked returns.
+NAN_METHOD(ParseAsync) {
+  if (!info[0]->IsString() || !info[1]->IsFunction()) {
+    Nan::ThrowTypeError("Expected a string and a callback");
+    return;
+  }
+  Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
+  Nan::AsyncQueueWorker(new ParseWorker(CopySource(info.GetIsolate(), info[0]), callback));
+}
+
+// parseBatchAsync([source, ...], callback) queues one worker per source, so a
+// batch is spread over all threads of the pool, and calls `callback(null,
+// trees)` with the trees in the order of the sources once all are parsed.
+NAN_METHOD(ParseBatchAsync) {
+  if (!info[0]->IsArray() || !info[1]->IsFunction()) {
+    Nan::ThrowTypeError("Expected an array of strings and a callback");
+    return;
+  }
+  Local<Array> sources = Local<Array>::Cast(info[0]);
+  uint32_t length = sources->Length();
+  std::vector<std::vector<uint16_t>> copies;
+  copies.reserve(length);
+  for (uint32_t i = 0; i < length; i++) {
+    Local<Value> source = Nan::Get(sources, i).ToLocalChecked();
+    if (!source->IsString()) {
+      Nan::ThrowTypeError("Expected an array of strings and a callback");
+      return;
+    }
+    copies.push_back(CopySource(info.GetIsolate(), source));
+  }
+
+  if (length == 0) {
+    Nan::AsyncQueueWorker(new EmptyBatchWorker(new Nan::Callback(info[1].As<Function>())));
+    return;
+  }
+  Local<Array> trees = Nan::New<Array>(length);
+  auto batch = std::make_shared<Batch>(trees, info[1].As<Function>(), length);
+  for (uint32_t i = 0; i < length; i++) {
+    Nan::AsyncQueueWorker(new ParseWorker(std::move(copies[i]), batch, i));
+  }
+}
+
 void Init(Local<Object> exports, Local<Object> module) {
   Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
   tpl->SetClassName(Nan::New("Language").ToLocalChecked());
@@ -20,6 +277,9 @@ void Init(Local<Object> exports, Local<Object> module) {
   Nan::SetInternalFieldPointer(instance, 0, tree_sitter_dummy());
 
   Nan::Set(instance, Nan::New("name").ToLocalChecked(), Nan::New("dummy").ToLocalChecked());
+  Nan::SetMethod(instance, "parsePacked", ParsePacked);
+  Nan::SetMethod(instance, "parseAsync", ParseAsync);
+  Nan::SetMethod(instance, "parseBatchAsync", ParseBatchAsync);
   Nan::Set(module, Nan::New("exports").ToLocalChecked(), instance);
 }
 
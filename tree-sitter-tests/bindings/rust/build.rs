@@ -9,6 +9,11 @@ fn main() {
         .flag_if_supported("-Wno-trigraphs");
     let parser_path = src_dir.join("parser.c");
     c_config.file(&parser_path);
+    // The `lex-runs` feature turns on the loops of `src/lex_runs.h` in the lexer.
+    let lex_runs = std::env::var_os("CARGO_FEATURE_LEX_RUNS").is_some();
+    if lex_runs {
+        c_config.define("TREE_SITTER_LEX_RUNS", None);
+    }
 
     // If your language uses an external scanner written in C,
     // then include this block of code:
@@ -21,6 +26,26 @@ fn main() {
 
     c_config.compile("parser");
     println!("cargo:rerun-if-changed={}", parser_path.to_str().unwrap());
+    println!("cargo:rerun-if-changed=src/lex_runs.h");
+
+    // The lexer built with and without the loops, which a test compares on the same input. Only
+    // a checkout has them, and only `lex-runs` builds them, so other builds get the parser alone.
+    let check_dir = std::path::Path::new("test/lex_runs");
+    println!("cargo:rustc-check-cfg=cfg(lex_check)");
+    if lex_runs && check_dir.exists() {
+        let mut check_config = cc::Build::new();
+        check_config.include(&src_dir);
+        check_config
+            .flag_if_supported("-Wno-unused-parameter")
+            .flag_if_supported("-Wno-unused-but-set-variable")
+            .flag_if_supported("-Wno-trigraphs");
+        check_config
+            .file(check_dir.join("plain.c"))
+            .file(check_dir.join("runs.c"));
+        check_config.compile("lex_check");
+        println!("cargo:rustc-cfg=lex_check");
+        println!("cargo:rerun-if-changed={}", check_dir.to_str().unwrap());
+    }
 
     // If your language uses an external scanner written in C++,
     // then include this block of code:
@@ -10,15 +10,67 @@ pub fn language() -> Language {
 }
 
 pub const NODE_TYPES: &str = include_str!("../../src/node-types.json");
-#[visitor_trait("../../src/node-types.json")]
+#[visitor_trait(
+    "../../src/node-types.json",
+    fuse,
+    edits,
+    queries(
+        number_product = r#"(mul_expr lhs: (number) @lhs "*" rhs: (number) @rhs)"#,
+        nested_parens = "(paren_expr body: (paren_expr) @inner)",
+        division = "(div_expr lhs: (_) @type rhs: (_) @tree)",
+        numeric_lhs = "(_ lhs: (number) @lhs)",
+    )
+)]
 pub trait CalcVisitor {}
 
+#[visitor_trait("../../src/node-types.json", kind_id, arena, chunked, asynchronous)]
+pub trait CalcVisitorById {}
+
+#[visitor_trait("../../src/node-types.json", kind_id, typed)]
+pub trait TypedCalcVisitor {}
+
+#[visitor_trait("../../src/node-types.json", kind_id, incremental, source)]
+pub trait IncrementalCalcVisitor {}
+
+#[visitor_trait("../../src/node-types.json", memoize)]
+pub trait MemoCalcVisitor {}
+
+#[visitor_trait(
+    "../../src/node-types.json",
+    only("root", "number"),
+    matching = "(add|sub)_expr"
+)]
+pub trait SumVisitor {}
+
+// Node types whose names clash with the other methods of the trait.
+#[visitor_trait("../../test/keywords/node-types.json")]
+pub trait KeywordVisitor {}
+
+#[visitor_trait("../../test/keywords/node-types.json", typed)]
+pub trait TypedKeywordVisitor {}
+
+// A trait named like the type parameters of the fused impls.
+#[visitor_trait("../../src/node-types.json", fuse)]
+pub trait A {}
+
 #[cfg(test)]
 mod tests {
-    use super::CalcVisitor;
-    use tree_sitter::Node;
+    use super::calc_visitor_by_id::Chunked;
+    use super::typed_calc_visitor::{AddExpr, DivExpr, MulExpr, Number, ParenExpr, Root, SubExpr};
+    use super::{
+        calc_visitor, calc_visitor_by_id, incremental_calc_visitor, memo_calc_visitor,
+        typed_keyword_visitor, CalcVisitor, CalcVisitorById, IncrementalCalcVisitor,
+        KeywordVisitor, MemoCalcVisitor, SumVisitor, TypedCalcVisitor, TypedKeywordVisitor,
+    };
+    use std::cell::Cell;
+    use std::future::Future;
+    use std::pin::Pin;
+    use std::rc::Rc;
+    use std::task::{Context, Poll, RawWaker, RawWakerVTable, Waker};
+    use std::vec::Drain;
+    use tree_sitter::{InputEdit, Node, Point};
 
-    #[derive(Default)]
+    #[derive(Default, Clone)]
     struct Calculator<'t> {
         src: &'t str,
     }
@@ -45,6 +97,390 @@ mod tests {
         // so a visitor can be written incrementally for large grammars
     }
 
+    struct IdCalculator<'t> {
+        src: &'t str,
+    }
+
+    impl<'t> CalcVisitorById for IdCalculator<'t> {
+        type ReturnType = f64;
+
+        fn visit_root(&mut self, node: &Node) -> f64 {
+            self.visit(&node.child(0).unwrap())
+        }
+
+        fn visit_number(&mut self, node: &Node) -> f64 {
+            self.src[node.byte_range()].parse().unwrap()
+        }
+
+        fn visit_mul_expr(&mut self, node: &Node) -> f64 {
+            let lhs = self.visit(&calc_visitor_by_id::mul_expr_lhs(node).unwrap());
+            let rhs = self.visit(&calc_visitor_by_id::mul_expr_rhs(node).unwrap());
+
+            lhs * rhs
+        }
+    }
+
+    struct TypedCalculator<'t> {
+        src: &'t str,
+    }
+
+    impl<'t> TypedCalcVisitor for TypedCalculator<'t> {
+        type ReturnType = f64;
+
+        fn visit_root(&mut self, node: Root) -> f64 {
+            node.typed_child(&mut node.walk()).unwrap().accept(self)
+        }
+
+        fn visit_number(&mut self, node: Number) -> f64 {
+            self.src[node.byte_range()].parse().unwrap()
+        }
+
+        fn visit_add_expr(&mut self, node: AddExpr) -> f64 {
+            node.lhs().unwrap().accept(self) + node.rhs().unwrap().accept(self)
+        }
+
+        fn visit_sub_expr(&mut self, node: SubExpr) -> f64 {
+            node.lhs().unwrap().accept(self) - node.rhs().unwrap().accept(self)
+        }
+
+        fn visit_mul_expr(&mut self, node: MulExpr) -> f64 {
+            node.lhs().unwrap().accept(self) * node.rhs().unwrap().accept(self)
+        }
+
+        fn visit_div_expr(&mut self, node: DivExpr) -> f64 {
+            node.lhs().unwrap().accept(self) / node.rhs().unwrap().accept(self)
+        }
+
+        fn visit_paren_expr(&mut self, node: ParenExpr) -> f64 {
+            node.body().unwrap().accept(self)
+        }
+    }
+
+    #[derive(Default)]
+    struct IncrementalCalculator<'t> {
+        src: &'t str,
+        // borrowed from the source, not the visitor
+        visited_numbers: Vec<&'t str>,
+        cache: incremental_calc_visitor::VisitCache<f64>,
+    }
+
+    impl<'t> IncrementalCalcVisitor<'t> for IncrementalCalculator<'t> {
+        type ReturnType = f64;
+
+        fn visit_cache(&mut self) -> &mut incremental_calc_visitor::VisitCache<f64> {
+            &mut self.cache
+        }
+
+        fn source(&self) -> &'t [u8] {
+            self.src.as_bytes()
+        }
+
+        fn visit_root(&mut self, node: &Node) -> f64 {
+            self.visit(&node.child(0).unwrap())
+        }
+
+        fn visit_number(&mut self, node: &Node) -> f64 {
+            let text = self.text(node);
+            self.visited_numbers.push(text);
+            text.parse().unwrap()
+        }
+
+        fn visit_add_expr(&mut self, node: &Node) -> f64 {
+            let lhs = self.visit(&node.child_by_field_name("lhs").unwrap());
+            let rhs = self.visit(&node.child_by_field_name("rhs").unwrap());
+
+            lhs + rhs
+        }
+    }
+
+    #[derive(Default)]
+    struct MemoCalculator<'t> {
+        src: &'t str,
+        visited_numbers: usize,
+        memo: memo_calc_visitor::MemoTable<f64>,
+    }
+
+    impl<'t> MemoCalcVisitor for MemoCalculator<'t> {
+        type ReturnType = f64;
+
+        fn memo_table(&mut self) -> &mut memo_calc_visitor::MemoTable<f64> {
+            &mut self.memo
+        }
+
+        fn reset(&mut self) {
+            self.visited_numbers = 0;
+        }
+
+        fn visit_root(&mut self, node: &Node) -> f64 {
+            self.visit(&node.child(0).unwrap())
+        }
+
+        fn visit_number(&mut self, node: &Node) -> f64 {
+            self.visited_numbers += 1;
+            self.src[node.byte_range()].parse().unwrap()
+        }
+
+        // visits `lhs` twice, which takes exponential time without the memo table
+        fn visit_add_expr(&mut self, node: &Node) -> f64 {
+            let lhs = node.child_by_field_name("lhs").unwrap();
+            let rhs = self.visit(&node.child_by_field_name("rhs").unwrap());
+
+            self.visit(&lhs) + rhs + self.visit(&lhs) - self.visit(&lhs)
+        }
+    }
+
+    struct Folder<'t> {
+        src: &'t str,
+    }
+
+    impl<'t> CalcVisitor for Folder<'t> {
+        type ReturnType = f64;
+
+        fn fold_root(&mut self, _node: &Node, mut children: Drain<f64>) -> f64 {
+            children.next().unwrap()
+        }
+
+        fn fold_number(&mut self, node: &Node, _children: Drain<f64>) -> f64 {
+            self.src[node.byte_range()].parse().unwrap()
+        }
+
+        fn fold_add_expr(&mut self, _node: &Node, children: Drain<f64>) -> f64 {
+            children.sum()
+        }
+    }
+
+    // only numbers are interesting, every other node just adds up its children
+    struct NumberCounter;
+
+    impl CalcVisitor for NumberCounter {
+        type ReturnType = usize;
+
+        fn visit_default(&mut self, node: &Node) -> usize {
+            let mut cursor = node.walk();
+            let children: Vec<_> = node.named_children(&mut cursor).collect();
+            children.iter().map(|child| self.visit(child)).sum()
+        }
+
+        fn visit_number(&mut self, _node: &Node) -> usize {
+            1
+        }
+    }
+
+    struct ChunkedCalculator<'t> {
+        text: &'t calc_visitor_by_id::ChunkedText,
+    }
+
+    impl<'t> CalcVisitorById for ChunkedCalculator<'t> {
+        type ReturnType = f64;
+
+        fn visit_root(&mut self, node: &Node) -> f64 {
+            self.visit(&node.child(0).unwrap())
+        }
+
+        fn visit_number(&mut self, node: &Node) -> f64 {
+            self.text.text(node).parse().unwrap()
+        }
+
+        fn visit_add_expr(&mut self, node: &Node) -> f64 {
+            let lhs = self.visit(&calc_visitor_by_id::add_expr_lhs(node).unwrap());
+            let rhs = self.visit(&calc_visitor_by_id::add_expr_rhs(node).unwrap());
+
+            lhs + rhs
+        }
+    }
+
+    #[derive(Default)]
+    struct Census<'t> {
+        src: &'t str,
+        numbers: Vec<&'t str>,
+        open_parens: usize,
+        max_parens: usize,
+    }
+
+    impl<'t> CalcVisitor for Census<'t> {
+        type ReturnType = ();
+
+        fn enter_number(&mut self, node: &Node) {
+            self.numbers.push(&self.src[node.byte_range()]);
+        }
+
+        fn enter_paren_expr(&mut self, _node: &Node) {
+            self.open_parens += 1;
+            self.max_parens = self.max_parens.max(self.open_parens);
+        }
+
+        fn leave_paren_expr(&mut self, _node: &Node) {
+            self.open_parens -= 1;
+        }
+    }
+
+    #[derive(Default)]
+    struct OperatorCounter {
+        operators: usize,
+    }
+
+    impl CalcVisitor for OperatorCounter {
+        type ReturnType = ();
+
+        fn enter_add_expr(&mut self, _node: &Node) {
+            self.operators += 1;
+        }
+
+        fn enter_mul_expr(&mut self, _node: &Node) {
+            self.operators += 1;
+        }
+    }
+
+    // counts into a cell the test keeps, for visitors that are boxed
+    struct SharedOperatorCounter(Rc<Cell<usize>>);
+
+    impl CalcVisitor for SharedOperatorCounter {
+        type ReturnType = ();
+
+        fn enter_add_expr(&mut self, _node: &Node) {
+            self.0.set(self.0.get() + 1);
+        }
+
+        fn enter_mul_expr(&mut self, _node: &Node) {
+            self.0.set(self.0.get() + 1);
+        }
+
+        fn reset(&mut self) {
+            self.0.set(0);
+        }
+    }
+
+    #[derive(Default)]
+    struct QueryCollector<'t> {
+        src: &'t str,
+        products: Vec<(&'t str, &'t str)>,
+        nested_parens: Vec<&'t str>,
+    }
+
+    impl<'t> CalcVisitor for QueryCollector<'t> {
+        type ReturnType = ();
+
+        fn on_number_product(&mut self, found: calc_visitor::NumberProductMatch) {
+            let (lhs, rhs) = (found.lhs.byte_range(), found.rhs.byte_range());
+            self.products.push((&self.src[lhs], &self.src[rhs]));
+        }
+
+        fn on_nested_parens(&mut self, found: calc_visitor::NestedParensMatch) {
+            self.nested_parens.push(&self.src[found.inner.byte_range()]);
+        }
+    }
+
+    /// Remembers the text of every number by its range, across edits.
+    #[derive(Default)]
+    struct NumberIndex {
+        src: String,
+        numbers: calc_visitor::RangeMap<String>,
+        invalidated: Vec<(std::ops::Range<usize>, String)>,
+    }
+
+    impl CalcVisitor for NumberIndex {
+        type ReturnType = ();
+
+        fn enter_number(&mut self, node: &Node) {
+            let text = self.src[node.byte_range()].to_string();
+            self.numbers.insert(node.byte_range(), text);
+        }
+
+        fn on_edit(&mut self, edit: &InputEdit) {
+            let invalidated = &mut self.invalidated;
+            self.numbers
+                .edit(edit, |range, text| invalidated.push((range, text)));
+        }
+    }
+
+    /// Adds and subtracts, and treats everything else as an opaque zero.
+    struct Summer<'t> {
+        src: &'t str,
+        opaque: Vec<&'static str>,
+    }
+
+    impl<'t> SumVisitor for Summer<'t> {
+        type ReturnType = f64;
+
+        fn visit_default(&mut self, node: &Node) -> f64 {
+            self.opaque.push(node.kind());
+            0.0
+        }
+
+        fn visit_root(&mut self, node: &Node) -> f64 {
+            self.visit(&node.child(0).unwrap())
+        }
+
+        fn visit_number(&mut self, node: &Node) -> f64 {
+            self.src[node.byte_range()].parse().unwrap()
+        }
+
+        fn visit_add_expr(&mut self, node: &Node) -> f64 {
+            let lhs = self.visit(&node.child_by_field_name("lhs").unwrap());
+            lhs + self.visit(&node.child_by_field_name("rhs").unwrap())
+        }
+
+        fn visit_sub_expr(&mut self, node: &Node) -> f64 {
+            let lhs = self.visit(&node.child_by_field_name("lhs").unwrap());
+            lhs - self.visit(&node.child_by_field_name("rhs").unwrap())
+        }
+    }
+
+    /// A future that is pending the first time it is polled, like a lookup waiting on I/O.
+    struct YieldOnce(bool);
+
+    impl Future for YieldOnce {
+        type Output = ();
+
+        fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<()> {
+            if std::mem::replace(&mut self.0, true) {
+                return Poll::Ready(());
+            }
+            cx.waker().wake_by_ref();
+            Poll::Pending
+        }
+    }
+
+    fn block_on<F: Future>(future: F) -> F::Output {
+        fn noop(_: *const ()) {}
+        fn clone(_: *const ()) -> RawWaker {
+            RawWaker::new(std::ptr::null(), &VTABLE)
+        }
+        static VTABLE: RawWakerVTable = RawWakerVTable::new(clone, noop, noop, noop);
+
+        let waker = unsafe { Waker::from_raw(clone(std::ptr::null())) };
+        let mut cx = Context::from_waker(&waker);
+        let mut future = Box::pin(future);
+        loop {
+            if let Poll::Ready(output) = future.as_mut().poll(&mut cx) {
+                return output;
+            }
+        }
+    }
+
+    struct AsyncCalculator<'t> {
+        src: &'t str,
+        lookups: usize,
+    }
+
+    impl<'t> CalcVisitorById for AsyncCalculator<'t> {
+        type ReturnType = f64;
+
+        async fn async_fold_number(&mut self, node: &Node<'_>, _children: Drain<'_, f64>) -> f64 {
+            YieldOnce(false).await;
+            self.lookups += 1;
+            self.src[node.byte_range()].parse().unwrap()
+        }
+
+        fn fold_root(&mut self, _node: &Node, mut children: Drain<f64>) -> f64 {
+            children.next().unwrap()
+        }
+
+        fn fold_add_expr(&mut self, _node: &Node, children: Drain<f64>) -> f64 {
+            children.sum()
+        }
+    }
+
     #[test]
     fn test_visitor_works() {
         let mut parser = tree_sitter::Parser::new();
@@ -62,4 +498,854 @@ mod tests {
 
         assert_eq!(result, 3.0);
     }
+
+    #[test]
+    fn test_visitor_by_kind_id_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "3 * 4";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let mut visitor = IdCalculator { src };
+        let result = visitor.visit(&parsed.root_node());
+
+        assert_eq!(result, 12.0);
+    }
+
+    #[test]
+    fn test_walk_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 + (2 * (3 - 4)) / 5";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let mut visitor = Census {
+            src,
+            ..Default::default()
+        };
+        let mut cursor = parsed.walk();
+        visitor.walk(&mut cursor);
+
+        assert_eq!(visitor.numbers, ["1", "2", "3", "4", "5"]);
+        assert_eq!(visitor.max_parens, 2);
+        assert_eq!(visitor.open_parens, 0);
+        assert_eq!(cursor.node(), parsed.root_node());
+    }
+
+    #[test]
+    fn test_typed_visitor_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "(1 + 2) * 3 - 8 / 4";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let mut visitor = TypedCalculator { src };
+        let result = visitor.visit(&parsed.root_node());
+
+        assert_eq!(result, 7.0);
+        assert!(Number::cast(parsed.root_node()).is_none());
+    }
+
+    #[test]
+    fn test_visit_parallel_works() {
+        let sources: Vec<String> = (1..=100).map(|i| format!("{} + {}", i, i)).collect();
+
+        let result = Calculator::default().visit_parallel(
+            super::language(),
+            &sources,
+            |visitor, src| visitor.src = src,
+            |a, b| a + b,
+        );
+
+        assert_eq!(result, Some(10100.0));
+    }
+
+    #[test]
+    fn test_visit_fork_join_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let numbers: Vec<String> = (1..=1000).map(|i| i.to_string()).collect();
+        let src = numbers.join(" + ");
+        let parsed = parser.parse(&src, None).expect("Could not parse");
+
+        // sums are split down to the ones shorter than 64 bytes, which are visited as a whole
+        let split = calc_visitor::ForkJoin {
+            min_children: usize::MAX,
+            min_bytes: 64,
+            threads: 4,
+        };
+        let visitor = Calculator { src: &src };
+        let subtrees = split.subtrees(parsed.root_node());
+        assert!(subtrees.len() > 4);
+        assert!(subtrees.iter().all(|node| node.byte_range().len() < 64));
+        let result = visitor.visit_fork_join(&parsed, &split, |a, b| a + b);
+        assert_eq!(result, 500_500.0);
+        assert_eq!(result, visitor.clone().visit(&parsed.root_node()));
+    }
+
+    #[test]
+    fn test_type_selection_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "10 - 2 * 3 + (4)";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        // `mul_expr` and `paren_expr` have no methods and share the fallback
+        let mut visitor = Summer {
+            src,
+            opaque: Vec::new(),
+        };
+        assert_eq!(visitor.visit(&parsed.root_node()), 10.0);
+        assert_eq!(visitor.opaque, ["mul_expr", "paren_expr"]);
+        assert_eq!(
+            visitor.visit_by_name("paren_expr", &parsed.root_node()),
+            0.0
+        );
+    }
+
+    #[test]
+    fn test_range_map_follows_edits() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let mut index = NumberIndex {
+            src: "1 + 22 + (333 * 4)".to_string(),
+            ..Default::default()
+        };
+        let mut tree = parser.parse(&index.src, None).expect("Could not parse");
+        index.walk(&mut tree.walk());
+        assert_eq!(index.numbers.len(), 4);
+
+        // replace "22" with "5555"
+        index.src.replace_range(4..6, "5555");
+        let edit = InputEdit {
+            start_byte: 4,
+            old_end_byte: 6,
+            new_end_byte: 8,
+            start_position: Point::new(0, 4),
+            old_end_position: Point::new(0, 6),
+            new_end_position: Point::new(0, 8),
+        };
+        index.apply_edit(&mut tree, &edit);
+
+        assert_eq!(index.invalidated, [(4..6, "22".to_string())]);
+        assert_eq!(index.numbers.get(0..1).unwrap(), "1");
+        assert_eq!(index.numbers.get(12..15).unwrap(), "333");
+        assert_eq!(index.numbers.get(18..19).unwrap(), "4");
+        assert!(index.numbers.get(10..13).is_none());
+
+        let mut seen = Vec::new();
+        index
+            .numbers
+            .overlapping(0..14, |range, text| seen.push((range, text.clone())));
+        assert_eq!(seen, [(0..1, "1".to_string()), (12..15, "333".to_string())]);
+
+        // only the new number is missing after the re-parse
+        let tree = parser
+            .parse(&index.src, Some(&tree))
+            .expect("Could not parse");
+        index.walk(&mut tree.walk());
+        assert_eq!(index.numbers.len(), 4);
+        assert_eq!(index.numbers.get(4..8).unwrap(), "5555");
+    }
+
+    #[test]
+    fn test_visit_incremental_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let mut visitor = IncrementalCalculator {
+            src: "1 + 2 + 3",
+            ..Default::default()
+        };
+        let mut tree = parser.parse(visitor.src, None).expect("Could not parse");
+        assert_eq!(visitor.visit_incremental(None, &tree), 6.0);
+        assert_eq!(visitor.visited_numbers, ["1", "2", "3"]);
+
+        visitor.src = "1 + 2 + 40";
+        tree.edit(&InputEdit {
+            start_byte: 8,
+            old_end_byte: 9,
+            new_end_byte: 10,
+            start_position: Point::new(0, 8),
+            old_end_position: Point::new(0, 9),
+            new_end_position: Point::new(0, 10),
+        });
+        let new_tree = parser
+            .parse(visitor.src, Some(&tree))
+            .expect("Could not parse");
+        assert_eq!(visitor.visit_incremental(Some(&tree), &new_tree), 43.0);
+        assert_eq!(visitor.visited_numbers, ["1", "2", "3", "40"]);
+
+        let root = new_tree.root_node();
+        let text = visitor.text(&root);
+        let bytes = visitor.bytes(&root.child(0).unwrap());
+        let unchecked = unsafe { visitor.text_unchecked(&root) };
+        drop(visitor);
+        assert_eq!(text, "1 + 2 + 40");
+        assert_eq!(bytes, b"1 + 2 + 40");
+        assert_eq!(unchecked, "1 + 2 + 40");
+    }
+
+    #[test]
+    fn test_visit_memoized_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 + 2 + 3 + 4 + 5 + 6 + 7 + 8";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let mut visitor = MemoCalculator {
+            src,
+            ..Default::default()
+        };
+        assert_eq!(visitor.visit_memoized(&parsed), 36.0);
+        assert_eq!(visitor.visited_numbers, 8);
+
+        let src = "9 + 10";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+        visitor.src = src;
+        assert_eq!(visitor.visit_memoized(&parsed), 19.0);
+        assert_eq!(visitor.visited_numbers, 10);
+        assert_eq!(visitor.memo.len(), 4);
+    }
+
+    #[test]
+    fn test_fold_iterative_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        // deep enough to overflow the stack of the test thread when visited recursively
+        let src = vec!["1"; 200_000].join("+");
+        let parsed = parser.parse(&src, None).expect("Could not parse");
+
+        let mut stack = calc_visitor::FoldStack::new();
+        let mut visitor = Folder { src: &src };
+        let result = visitor.fold_iterative(&parsed.root_node(), &mut stack);
+
+        assert_eq!(result, 200_000.0);
+        assert_eq!(
+            visitor.fold_iterative(&parsed.root_node().child(0).unwrap(), &mut stack),
+            200_000.0
+        );
+    }
+
+    #[test]
+    fn test_async_fold_iterative_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = vec!["2"; 100_000].join("+");
+        let parsed = parser.parse(&src, None).expect("Could not parse");
+
+        let mut stack = calc_visitor_by_id::FoldStack::new();
+        let mut visitor = AsyncCalculator {
+            src: &src,
+            lookups: 0,
+        };
+        let result = block_on(visitor.async_fold_iterative(&parsed.root_node(), &mut stack));
+
+        assert_eq!(result, 200_000.0);
+        assert_eq!(visitor.lookups, 100_000);
+    }
+
+    #[test]
+    fn test_children_helpers_work() {
+        use calc_visitor::{children_of_add_expr, children_of_root, SmallChildren};
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "12 + (3 * 4)";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+        let [add] = children_of_root(&parsed.root_node()).unwrap();
+        let [lhs, rhs] = children_of_add_expr(&add).unwrap();
+        assert_eq!(&src[lhs.byte_range()], "12");
+        assert_eq!(rhs.kind(), "paren_expr");
+        assert!(children_of_add_expr(&lhs).is_none());
+
+        let children = SmallChildren::new(&add);
+        assert_eq!(&*children, &[lhs, rhs]);
+        assert!(SmallChildren::new(&lhs).is_empty());
+    }
+
+    #[test]
+    fn test_children_helpers_skip_anonymous_fields() {
+        use super::keyword_visitor::{children_of_binary_expression, children_of_unary_expression};
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        // Only the number of named children is checked, so an `add_expr` stands in for the
+        // `binary_expression` of the fixture, whose `operator` field holds `"+"` or `"-"`.
+        let parsed = parser.parse("1 + 2", None).expect("Could not parse");
+        let add = parsed.root_node().child(0).unwrap();
+        let [left, right] = children_of_binary_expression(&add).unwrap();
+        assert_eq!((left.kind(), right.kind()), ("number", "number"));
+
+        // An `operator` that can also be a named node leaves the count open.
+        let children = children_of_unary_expression(&add);
+        assert_eq!(&*children, &[left, right]);
+    }
+
+    #[test]
+    fn test_arena_works() {
+        use calc_visitor_by_id::{Ast, AstId};
+
+        fn eval(ast: &Ast, src: &str, id: AstId) -> f64 {
+            if ast.is_number(id) {
+                src[ast.byte_range(id)].parse().unwrap()
+            } else if ast.is_add_expr(id) {
+                eval(ast, src, ast.add_expr_lhs(id).unwrap())
+                    + eval(ast, src, ast.add_expr_rhs(id).unwrap())
+            } else if ast.is_mul_expr(id) {
+                eval(ast, src, ast.mul_expr_lhs(id).unwrap())
+                    * eval(ast, src, ast.mul_expr_rhs(id).unwrap())
+            } else {
+                eval(ast, src, ast.children(id).next().unwrap())
+            }
+        }
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "(1 + 2) * 3";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+        let mut ast = Ast::build(&parsed.root_node());
+
+        // operators and parentheses are not kept
+        assert_eq!(ast.len(), 7);
+        assert_eq!(eval(&ast, src, ast.root().unwrap()), 9.0);
+        let mul = ast.children(ast.root().unwrap()).next().unwrap();
+        assert_eq!(ast.parent(mul), ast.root());
+        assert_eq!(ast.children(mul).count(), 2);
+
+        let src = "4 * 5";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+        ast.rebuild(&parsed.root_node());
+        assert_eq!(eval(&ast, src, ast.root().unwrap()), 20.0);
+    }
+
+    #[test]
+    fn test_ast_view_works() {
+        use calc_visitor_by_id::{Ast, AstId, AstView};
+
+        fn eval(ast: &AstView, src: &str, id: AstId) -> f64 {
+            if ast.is_number(id) {
+                src[ast.byte_range(id)].parse().unwrap()
+            } else if ast.is_add_expr(id) {
+                eval(ast, src, ast.add_expr_lhs(id).unwrap())
+                    + eval(ast, src, ast.add_expr_rhs(id).unwrap())
+            } else if ast.is_mul_expr(id) {
+                eval(ast, src, ast.mul_expr_lhs(id).unwrap())
+                    * eval(ast, src, ast.mul_expr_rhs(id).unwrap())
+            } else {
+                eval(ast, src, ast.children(id).next().unwrap())
+            }
+        }
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "(1 + 2) * 3 + 4";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+        let ast = Ast::build(&parsed.root_node());
+        let bytes = ast.to_bytes();
+        let view = AstView::new(&bytes).unwrap();
+
+        assert_eq!(view.len(), ast.len());
+        assert_eq!(eval(&view, src, view.root().unwrap()), 13.0);
+        for id in (0..ast.len() as u32).map(AstId) {
+            assert_eq!(view.kind_id(id), ast.kind_id(id));
+            assert_eq!(view.field_id(id), ast.field_id(id));
+            assert_eq!(view.byte_range(id), ast.byte_range(id));
+            assert_eq!(view.parent(id), ast.parent(id));
+            assert!(view.children(id).eq(ast.children(id)));
+        }
+
+        assert!(AstView::new(&bytes[..bytes.len() - 1]).is_err());
+        assert!(AstView::new(&bytes[1..]).is_err());
+        // an empty Ast has no root to go out of bounds on
+        assert_eq!(Ast::default().root(), None);
+        let empty = Ast::default().to_bytes();
+        assert_eq!(AstView::new(&empty).unwrap().root(), None);
+
+        // a buffer from another grammar has another fingerprint in its header
+        let mut foreign = bytes.clone();
+        foreign[20] ^= 1;
+        assert!(AstView::new(&foreign).is_err());
+
+        // a subtree that ends before its node would make `children` loop
+        let subtree_ends = 28 + 3 * 4 * ast.len();
+        let mut corrupt = bytes.clone();
+        corrupt[subtree_ends + 4..subtree_ends + 8].copy_from_slice(&1u32.to_le_bytes());
+        assert!(AstView::new(&corrupt).is_err());
+    }
+
+    #[test]
+    fn test_visit_default_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 + (2 * (3 - 4)) / 5";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        assert_eq!(NumberCounter.visit(&parsed.root_node()), 5);
+    }
+
+    struct Keywords;
+
+    impl KeywordVisitor for Keywords {
+        type ReturnType = &'static str;
+
+        fn visit_default(&mut self, _node: &Node) -> &'static str {
+            "fallback"
+        }
+
+        fn visit_default_(&mut self, _node: &Node) -> &'static str {
+            "default"
+        }
+
+        fn fold_iterative_(
+            &mut self,
+            _node: &Node,
+            _children: Drain<&'static str>,
+        ) -> &'static str {
+            "iterative"
+        }
+    }
+
+    #[test]
+    fn test_reserved_type_names_are_escaped() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let parsed = parser.parse("1", None).expect("Could not parse");
+        let root = parsed.root_node();
+
+        assert_eq!(Keywords.visit_by_name("default", &root), "default");
+        assert_eq!(Keywords.visit_by_name("iterative", &root), "fallback");
+        assert_eq!(Keywords.visit(&root), "fallback");
+        let mut children = Vec::new();
+        assert_eq!(
+            Keywords.fold_iterative_(&root, children.drain(..)),
+            "iterative"
+        );
+    }
+
+    #[derive(Default)]
+    struct Casts {
+        casts: usize,
+        selves: usize,
+    }
+
+    impl TypedKeywordVisitor for Casts {
+        type ReturnType = ();
+
+        fn visit_cast_expression(&mut self, node: typed_keyword_visitor::CastExpression) {
+            self.casts += 1;
+            if let Some(target) = node.r#type() {
+                target.accept(self);
+            }
+        }
+
+        fn visit_self(&mut self, _node: typed_keyword_visitor::Self_) {
+            self.selves += 1;
+        }
+    }
+
+    #[test]
+    fn test_typed_keyword_names_are_escaped() {
+        use super::typed_keyword_visitor::{CastExpression, Self_};
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let parsed = parser.parse("1", None).expect("Could not parse");
+        let root = parsed.root_node();
+        assert!(CastExpression::cast(root).is_none());
+        assert!(Self_::cast(root).is_none());
+
+        // The dummy grammar has no `type` field, so the cast has nothing to recurse into.
+        let mut visitor = Casts::default();
+        CastExpression::from_node_unchecked(root).accept(&mut visitor);
+        Self_::from_node_unchecked(root).accept(&mut visitor);
+        assert_eq!((visitor.casts, visitor.selves), (1, 1));
+    }
+
+    #[test]
+    fn test_visit_by_name_works() {
+        use super::calc_visitor::kind_slot;
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 + (2 * 3)";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+        let root = parsed.root_node();
+
+        assert_eq!(NumberCounter.visit_by_name("root", &root), 3);
+        assert_eq!(NumberCounter.visit_by_name("number", &root), 1);
+        assert_eq!(NumberCounter.visit_by_name("no_such_type", &root), 3);
+
+        let names = [
+            "+",
+            "-",
+            "*",
+            "/",
+            "(",
+            ")",
+            "number",
+            "root",
+            "add_expr",
+            "paren_expr",
+        ];
+        let mut slots: Vec<_> = names.iter().map(|name| kind_slot(name).unwrap()).collect();
+        slots.sort_unstable();
+        slots.dedup();
+        assert_eq!(slots.len(), names.len());
+        assert_eq!(kind_slot("add_exp"), None);
+        assert_eq!(kind_slot(""), None);
+    }
+
+    #[test]
+    fn test_visit_stats_works() {
+        use super::calc_visitor_by_id::visit_stats;
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 * 2 * 3";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+        IdCalculator { src }.visit(&parsed.root_node());
+
+        let stats = visit_stats();
+        if cfg!(feature = "stats") {
+            // Other tests visit with the same trait concurrently, so the counts only grow.
+            let number = stats.iter().find(|stats| stats.kind == "number").unwrap();
+            assert!(number.calls >= 3);
+            assert!(stats.iter().any(|stats| stats.kind == "mul_expr"));
+        } else {
+            assert!(stats.is_empty());
+        }
+    }
+
+    #[cfg(feature = "profile")]
+    #[global_allocator]
+    static ALLOCATOR: calc_visitor::CountingAllocator =
+        calc_visitor::CountingAllocator(std::alloc::System);
+
+    #[cfg(feature = "profile")]
+    #[test]
+    fn test_profile_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 + (2 * (3 + 4)) * 5";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let mut visitor = Census {
+            src,
+            ..Census::default()
+        };
+        let ((), profile) = calc_visitor::profile(|| visitor.walk(&mut parsed.walk()));
+        let number = profile
+            .kinds
+            .iter()
+            .find(|kind| kind.kind == "number")
+            .unwrap();
+        // the pushes onto `numbers` are charged to the nodes that made them
+        assert_eq!(number.nodes, 5);
+        assert!(number.allocations > 0 && number.bytes > 0);
+        assert!(profile.allocations >= number.allocations);
+        // root, add, mul, paren, mul, paren, add, number
+        assert_eq!(profile.peak_depth, 8);
+        assert!(profile
+            .to_json()
+            .contains(r#"{"kind":"number","nodes":5,"allocations":"#));
+
+        // a panic in the profiled closure does not leave profiling switched on
+        assert!(
+            std::panic::catch_unwind(|| calc_visitor::profile(|| panic!("in profile"))).is_err()
+        );
+        let ((), again) = calc_visitor::profile(|| visitor.walk(&mut parsed.walk()));
+        assert_eq!(again.nodes, profile.nodes);
+    }
+
+    #[test]
+    fn test_fused_walk_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 + (2 * (3 + 4)) * 5";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let mut fused = (
+            Census {
+                src,
+                ..Census::default()
+            },
+            (OperatorCounter::default(), OperatorCounter::default()),
+        );
+        fused.walk(&mut parsed.walk());
+        let (census, (first, second)) = fused;
+        assert_eq!(census.numbers, ["1", "2", "3", "4", "5"]);
+        assert_eq!(census.max_parens, 2);
+        assert_eq!((first.operators, second.operators), (4, 4));
+
+        let (first, second) = (Rc::new(Cell::new(0)), Rc::new(Cell::new(10)));
+        let mut boxed: Vec<Box<dyn CalcVisitor<ReturnType = ()>>> = vec![
+            Box::new(SharedOperatorCounter(first.clone())),
+            Box::new(SharedOperatorCounter(second.clone())),
+        ];
+        boxed.walk(&mut parsed.walk());
+        assert_eq!((first.get(), second.get()), (4, 14));
+        boxed.reset();
+        assert_eq!((first.get(), second.get()), (0, 0));
+    }
+
+    #[test]
+    fn test_queries_work() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 * 2 + ((3 * 4)) * 5 + (6 / 7)";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let mut visitor = QueryCollector {
+            src,
+            ..Default::default()
+        };
+        visitor.walk(&mut parsed.walk());
+        assert_eq!(visitor.products, [("1", "2"), ("3", "4")]);
+        assert_eq!(visitor.nested_parens, ["(3 * 4)"]);
+
+        // groups of visitors forward the query hooks like any other
+        let mut fused = (
+            OperatorCounter::default(),
+            QueryCollector {
+                src,
+                ..Default::default()
+            },
+        );
+        fused.walk(&mut parsed.walk());
+        assert_eq!(fused.0.operators, 5);
+        assert_eq!(fused.1.products, visitor.products);
+
+        let sum = calc_visitor::add_expr_lhs(&parsed.root_node().child(0).unwrap()).unwrap();
+        let product = calc_visitor::add_expr_lhs(&sum).unwrap();
+        let found = calc_visitor::match_number_product(&product).unwrap();
+        assert_eq!(found.node, product);
+        assert!(calc_visitor::match_number_product(&sum).is_none());
+
+        // a wildcard with a field matches any type that has it
+        let found = calc_visitor::match_numeric_lhs(&product).unwrap();
+        assert_eq!(found.lhs.byte_range(), 0..1);
+        assert!(calc_visitor::match_numeric_lhs(&sum).is_none());
+
+        // captures named after keywords or the matcher's own names are fields like any other
+        let parsed = parser.parse("6 / 7", None).expect("Could not parse");
+        let div = parsed.root_node().child(0).unwrap();
+        let found = calc_visitor::match_division(&div).unwrap();
+        assert_eq!(
+            (found.r#type.byte_range(), found.tree.byte_range()),
+            (0..1, 4..5)
+        );
+    }
+
+    #[test]
+    fn test_walk_filtered_works() {
+        use super::calc_visitor::KindFilter;
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let src = "1 + (2 * (3 - 4)) / 5";
+        let parsed = parser.parse(src, None).expect("Could not parse");
+
+        let filter = KindFilter::new(&["paren_expr", "number"]);
+        let mut visitor = Census {
+            src,
+            ..Default::default()
+        };
+        visitor.walk_filtered(&mut parsed.walk(), &filter);
+
+        assert_eq!(visitor.numbers, ["1", "2", "3", "4", "5"]);
+        assert_eq!(visitor.max_parens, 2);
+
+        let number =
+            super::calc_visitor::add_expr_lhs(&parsed.root_node().child(0).unwrap()).unwrap();
+        assert_eq!(number.kind(), "number");
+        assert!(!filter.may_contain(&number));
+        assert!(filter.may_contain(&parsed.root_node()));
+        // the root is not contained in anything, so looking for it can't skip a subtree
+        assert!(KindFilter::new(&["root"]).may_contain(&number));
+    }
+
+    #[test]
+    fn test_visit_batch_works() {
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        let batch = ["1 + 2", "3", "4 + 5 + 6"]
+            .iter()
+            .map(|src| (*src, parser.parse(src, None).expect("Could not parse")))
+            .collect::<Vec<_>>();
+
+        let mut visitor = MemoCalculator::default();
+        let mut results = Vec::new();
+        visitor.visit_batch(
+            batch,
+            |visitor, src| visitor.src = src,
+            |src, _tree, result| results.push((src, result)),
+        );
+
+        assert_eq!(results, [("1 + 2", 3.0), ("3", 3.0), ("4 + 5 + 6", 15.0)]);
+        assert_eq!(visitor.visited_numbers, 3);
+    }
+
+    #[test]
+    fn test_chunked_input_works() {
+        use calc_visitor_by_id::{parse_chunked, ChunkedText};
+        use std::borrow::Cow;
+
+        let mut parser = tree_sitter::Parser::new();
+        parser
+            .set_language(super::language())
+            .expect("Error loading dummy language");
+
+        // small pages, so that numbers straddle them
+        let src = "12 + 345 + 6789";
+        let text = ChunkedText::read_with_page_size(src.as_bytes(), 4).unwrap();
+        let parsed = parse_chunked(&mut parser, &text, None).expect("Could not parse");
+
+        let mut visitor = ChunkedCalculator { text: &text };
+        assert_eq!(visitor.visit(&parsed.root_node()), 7146.0);
+
+        let add = parsed.root_node().child(0).unwrap();
+        let rhs = calc_visitor_by_id::add_expr_rhs(&add).unwrap();
+        assert_eq!(text.text(&rhs), "6789");
+        assert!(matches!(src.text(&rhs), Cow::Borrowed("6789")));
+
+        // offsets past the end of a partial last page are still within its page size
+        let short = ChunkedText::read_with_page_size(&b"123456"[..], 4).unwrap();
+        assert_eq!(short.chunk(5), b"6");
+        assert_eq!(short.chunk(6), b"");
+        assert_eq!(short.chunk(7), b"");
+        assert_eq!(short.chunk(8), b"");
+    }
+
+    // built by `lex-runs` in a checkout
+    #[cfg(lex_check)]
+    #[test]
+    fn test_lex_runs_match_the_generated_lexer() {
+        type LexCheck = unsafe extern "C" fn(*const u8, u32, *mut u32, usize, *mut u32) -> usize;
+        extern "C" {
+            fn lex_check_plain(
+                input: *const u8,
+                length: u32,
+                tokens: *mut u32,
+                capacity: usize,
+                calls: *mut u32,
+            ) -> usize;
+            fn lex_check_runs(
+                input: *const u8,
+                length: u32,
+                tokens: *mut u32,
+                capacity: usize,
+                calls: *mut u32,
+            ) -> usize;
+        }
+        fn lex(check: LexCheck, input: &[u8], calls: &mut u32) -> Vec<u32> {
+            let mut tokens = vec![0; 4 * 64];
+            let count = unsafe {
+                check(
+                    input.as_ptr(),
+                    input.len() as u32,
+                    tokens.as_mut_ptr(),
+                    64,
+                    calls,
+                )
+            };
+            tokens.truncate(4 * count);
+            tokens
+        }
+
+        // random strings over the lexer's characters and a few it rejects
+        let alphabet = b"0123456789012345.. \t\n\r+-*/()x";
+        let mut state = 0x2545_f491_4f6c_dd1d_u64;
+        let (mut plain_calls, mut runs_calls) = (0, 0);
+        for _ in 0..2000 {
+            let mut input = Vec::new();
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            for _ in 0..state % 40 {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                input.push(alphabet[(state % alphabet.len() as u64) as usize]);
+            }
+            assert_eq!(
+                lex(lex_check_plain, &input, &mut plain_calls),
+                lex(lex_check_runs, &input, &mut runs_calls),
+                "{:?}",
+                String::from_utf8_lossy(&input)
+            );
+        }
+        assert!(runs_calls < plain_calls);
+    }
 }
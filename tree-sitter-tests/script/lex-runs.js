@@ -0,0 +1,69 @@
+// Inserts the run loops of `src/lex_runs.h` into the generated `src/parser.c`, which
+// `tree-sitter generate` overwrites. `yarn generate` runs this after generating; running it
+// again on a file that already has the loops changes nothing.
+//
+// Every lex state with a transition to itself, such as
+//
+//     case 8:
+//       ACCEPT_TOKEN(sym_number);
+//       if (('0' <= lookahead && lookahead <= '9')) ADVANCE(8);
+//
+// gets an `ADVANCE_WHILE` (or `SKIP_WHILE`) with the same condition as its first statement. The
+// generated transition is kept, so the lexer is unchanged unless `TREE_SITTER_LEX_RUNS` is defined.
+
+const fs = require('fs');
+const path = require('path');
+
+const parserPath = path.join(__dirname, '..', 'src', 'parser.c');
+const include = '#include <tree_sitter/parser.h>\n';
+const runsInclude = '#include "lex_runs.h"\n';
+
+const statementIndent = '      ';
+const transition = /^if \(([\s\S]*)\) (ADVANCE|SKIP)\((\d+)\);?$/;
+
+function insertRuns(source) {
+  const lines = source.split('\n');
+  const output = [];
+  let inLexer = false;
+  let i = 0;
+  while (i < lines.length) {
+    const line = lines[i];
+    if (/^static bool ts_lex(_keywords)?\(/.test(line)) inLexer = true;
+    else if (line === '}') inLexer = false;
+
+    const state = inLexer && /^    case (\d+):$/.exec(line);
+    if (!state) {
+      output.push(line);
+      i++;
+      continue;
+    }
+
+    // A statement starts at the indentation of the case body and may continue on deeper lines.
+    const statements = [];
+    let j = i + 1;
+    while (j < lines.length && lines[j].startsWith(statementIndent)) {
+      if (lines[j][statementIndent.length] !== ' ') statements.push([]);
+      statements[statements.length - 1].push(lines[j]);
+      j++;
+    }
+
+    output.push(line);
+    const hasRuns = statements.some(([first]) => /^ *(ADVANCE|SKIP)_WHILE\(/.test(first));
+    for (const statement of statements) {
+      const match = transition.exec(statement.join('\n').trimStart());
+      if (hasRuns || !match || match[3] !== state[1]) continue;
+      const [, condition, action] = match;
+      output.push(`${statementIndent}${action}_WHILE(${condition})`);
+    }
+    for (const statement of statements) output.push(...statement);
+    i = j;
+  }
+  return output.join('\n');
+}
+
+let source = fs.readFileSync(parserPath, 'utf8');
+if (!source.includes(runsInclude)) {
+  if (!source.includes(include)) throw new Error(`${parserPath} does not include the parser header`);
+  source = source.replace(include, include + runsInclude);
+}
+fs.writeFileSync(parserPath, insertRuns(source));
@@ -0,0 +1,40 @@
+#ifndef TREE_SITTER_LEX_RUNS_H_
+#define TREE_SITTER_LEX_RUNS_H_
+
+// Loops for the lex states that transition to themselves, such as the digits of a number or the
+// whitespace before a token. The generated lexer takes one `ADVANCE` or `SKIP` per character,
+// which jumps back to the top of `ts_lex` and re-enters the state through the `switch`; these
+// macros consume the whole run in place instead.
+//
+// `parser.c` is generated, so `script/lex-runs.js` inserts the macros at the top of every
+// self-looping state again after `tree-sitter generate` (`yarn generate` runs both). The
+// generated self-transitions stay in place, so without `TREE_SITTER_LEX_RUNS`, which the `lex-runs`
+// cargo feature and the `lex_runs` gyp variable define, the macros expand to nothing and the
+// lexer is exactly the generated one. With it, the run is consumed before the state's other
+// transitions are tried, which is equivalent because the character sets of a state's transitions
+// are disjoint.
+
+#ifdef TREE_SITTER_LEX_RUNS
+
+#define ADVANCE_WHILE(condition)    \
+  while (!eof && (condition)) {     \
+    lexer->advance(lexer, false);   \
+    lookahead = lexer->lookahead;   \
+    eof = lexer->eof(lexer);        \
+  }
+
+#define SKIP_WHILE(condition)       \
+  while (!eof && (condition)) {     \
+    lexer->advance(lexer, true);    \
+    lookahead = lexer->lookahead;   \
+    eof = lexer->eof(lexer);        \
+  }
+
+#else
+
+#define ADVANCE_WHILE(condition)
+#define SKIP_WHILE(condition)
+
+#endif
+
+#endif  // TREE_SITTER_LEX_RUNS_H_
@@ -1,4 +1,5 @@
 #include <tree_sitter/parser.h>
+#include "lex_runs.h"
 
 #if defined(__GNUC__) || defined(__clang__)
 #pragma GCC diagnostic push
@@ -171,6 +172,10 @@ static bool ts_lex(TSLexer *lexer, TSStateId state) {
   eof = lexer->eof(lexer);
   switch (state) {
     case 0:
+      SKIP_WHILE(lookahead == '\t' ||
+          lookahead == '\n' ||
+          lookahead == '\r' ||
+          lookahead == ' ')
       if (eof) ADVANCE(1);
       if (lookahead == '(') ADVANCE(6);
       if (lookahead == ')') ADVANCE(7);
@@ -206,11 +211,13 @@ static bool ts_lex(TSLexer *lexer, TSStateId state) {
       ACCEPT_TOKEN(anon_sym_RPAREN);
       END_STATE();
     case 8:
+      ADVANCE_WHILE(('0' <= lookahead && lookahead <= '9'))
       ACCEPT_TOKEN(sym_number);
       if (lookahead == '.') ADVANCE(9);
       if (('0' <= lookahead && lookahead <= '9')) ADVANCE(8);
       END_STATE();
     case 9:
+      ADVANCE_WHILE(('0' <= lookahead && lookahead <= '9'))
       ACCEPT_TOKEN(sym_number);
       if (('0' <= lookahead && lookahead <= '9')) ADVANCE(9);
       END_STATE();
@@ -0,0 +1,54 @@
+// Checks the native methods of the Node binding. Run with `yarn test` after building it.
+
+const assert = require('assert');
+const dummy = require('../bindings/node');
+
+const NO_PARENT = 0xffffffff;
+
+// kind id, start, end and parent index of every node of `1 + 2`, in pre-order
+const onePlusTwo = [
+  8, 0, 5, NO_PARENT, // root
+  10, 0, 5, 0, // add_expr
+  7, 0, 1, 1, // number
+  1, 2, 3, 1, // +
+  7, 4, 5, 1, // number
+];
+
+const tree = dummy.parsePacked('1 + 2');
+assert(tree instanceof Uint32Array);
+assert.deepStrictEqual(Array.from(tree), onePlusTwo);
+
+const trees = dummy.parsePacked(['1 + 2', '3']);
+assert.strictEqual(trees.length, 2);
+assert.deepStrictEqual(Array.from(trees[0]), onePlusTwo);
+assert.deepStrictEqual(Array.from(trees[1]), [8, 0, 1, NO_PARENT, 7, 0, 1, 0]);
+assert.deepStrictEqual(dummy.parsePacked([]), []);
+
+assert.throws(() => dummy.parsePacked(3), TypeError);
+assert.throws(() => dummy.parsePacked(['1', 2]), TypeError);
+
+dummy.parseAsync('1 + 2', (error, tree) => {
+  assert.ifError(error);
+  assert.deepStrictEqual(Array.from(tree), onePlusTwo);
+});
+
+dummy.parseBatchAsync(['1 + 2', '3'], (error, trees) => {
+  assert.ifError(error);
+  assert.deepStrictEqual(trees.map(tree => Array.from(tree)), [
+    onePlusTwo,
+    [8, 0, 1, NO_PARENT, 7, 0, 1, 0],
+  ]);
+});
+
+// an empty batch still calls back later, not before `parseBatchAsync` returns
+let calledBack = false;
+dummy.parseBatchAsync([], (error, trees) => {
+  assert.ifError(error);
+  assert.deepStrictEqual(trees, []);
+  calledBack = true;
+});
+assert(!calledBack);
+process.on('exit', () => assert(calledBack));
+
+assert.throws(() => dummy.parseAsync('1'), TypeError);
+assert.throws(() => dummy.parseBatchAsync(['1', 2], () => {}), TypeError);
@@ -0,0 +1,79 @@
+// Runs the lexer of `parser.c` over a string with a mock `TSLexer`, for comparing the lexer built
+// without `TREE_SITTER_LEX_RUNS` to the one built with it. `plain.c` and `runs.c` include this
+// with `LEX_CHECK` set to the name of the function to define.
+
+#include <stdint.h>
+#include <string.h>
+
+#define LEX_CHECK_PASTE(a, b) a##b
+#define LEX_CHECK_NAME(a, b) LEX_CHECK_PASTE(a, b)
+
+// Each build of the lexer comes with its own language, which must not clash with the real one.
+#define tree_sitter_dummy LEX_CHECK_NAME(LEX_CHECK, _language)
+#include "../../src/parser.c"
+#undef tree_sitter_dummy
+
+typedef struct {
+  TSLexer lexer;
+  const char *input;
+  uint32_t length;
+  uint32_t position;
+  uint32_t start;
+  uint32_t end;
+  uint32_t calls;
+} MockLexer;
+
+static void mock_set_lookahead(MockLexer *mock) {
+  mock->lexer.lookahead =
+      mock->position < mock->length ? (unsigned char)mock->input[mock->position] : 0;
+}
+
+static void mock_advance(TSLexer *lexer, bool skip) {
+  MockLexer *mock = (MockLexer *)lexer;
+  mock->calls++;
+  if (mock->position < mock->length) mock->position++;
+  if (skip) mock->start = mock->position;
+  mock_set_lookahead(mock);
+}
+
+static void mock_mark_end(TSLexer *lexer) {
+  MockLexer *mock = (MockLexer *)lexer;
+  mock->calls++;
+  mock->end = mock->position;
+}
+
+static bool mock_eof(const TSLexer *lexer) {
+  const MockLexer *mock = (const MockLexer *)lexer;
+  return mock->position >= mock->length;
+}
+
+// Lexes `input` from lex state 0 until the end token or an error, writing four numbers per token
+// to `tokens`: whether a token was accepted, its symbol, its start and its end. Returns the number
+// of tokens written, at most `capacity`, and adds the calls into the lexer to `calls`.
+size_t LEX_CHECK(const char *input, uint32_t length, uint32_t *tokens, size_t capacity,
+                 uint32_t *calls) {
+  MockLexer mock;
+  memset(&mock, 0, sizeof mock);
+  mock.lexer.advance = mock_advance;
+  mock.lexer.mark_end = mock_mark_end;
+  mock.lexer.eof = mock_eof;
+  mock.input = input;
+  mock.length = length;
+
+  size_t count = 0;
+  while (count < capacity) {
+    mock.start = mock.position;
+    mock.end = mock.position;
+    mock_set_lookahead(&mock);
+    bool accepted = ts_lex(&mock.lexer, 0);
+    uint32_t *token = &tokens[count++ * 4];
+    token[0] = accepted;
+    token[1] = accepted ? mock.lexer.result_symbol : 0;
+    token[2] = mock.start;
+    token[3] = mock.end;
+    if (!accepted || mock.lexer.result_symbol == ts_builtin_sym_end) break;
+    mock.position = mock.end;
+  }
+  *calls += mock.calls;
+  return count;
+}
@@ -0,0 +1,3 @@
+// The lexer exactly as generated.
+#define LEX_CHECK lex_check_plain
+#include "check.h"
@@ -0,0 +1,4 @@
+// The lexer with the run loops of `src/lex_runs.h`.
+#define TREE_SITTER_LEX_RUNS
+#define LEX_CHECK lex_check_runs
+#include "check.h"
@@ -0,0 +1,103 @@
+//! Generates the field accessors of the support module.
+
+use crate::node_types::Node;
+use crate::sanitize_identifier;
+use crate::symbols::SymbolTable;
+use proc_macro2::TokenStream;
+use quote::{format_ident, quote};
+
+/// Generates a `fields` module with the id of every field and a `<node type>_<field>()` accessor
+/// for every field of every node type.
+///
+/// When the symbol table is known, accessors look children up by their numeric field id, which
+/// avoids comparing field names inside tree-sitter on every call.
+pub fn field_accessors(nodes: &[Node], symbols: Option<&SymbolTable>) -> TokenStream {
+    let field_ids = symbols.map(|symbols| {
+        let consts = symbols.fields.iter().map(|(id, name)| {
+            let const_name = field_const(name);
+            let doc = format!("Field id of `{}`", name);
+            quote! {
+                #[doc=#doc]
+                pub const #const_name: u16 = #id;
+            }
+        });
+        quote! {
+            #[doc=r"Numeric ids of the fields in the grammar, as returned by `TreeCursor::field_id()`."]
+            pub mod fields {
+                #(#consts)*
+            }
+        }
+    });
+
+    let accessors = nodes.iter().flat_map(|node| {
+        node.fields.iter().map(move |(field_name, field)| {
+            let fn_name = format_ident!(
+                "{}_{}",
+                sanitize_identifier(&node.r#type),
+                sanitize_identifier(field_name)
+            );
+            if field.multiple {
+                let doc = format!(
+                    "Iterates over the `{}` children of the given `{}` node",
+                    field_name, node.r#type
+                );
+                let lookup = children_lookup(symbols.is_some(), quote! { node }, field_name);
+                quote! {
+                    #[doc=#doc]
+                    #[inline]
+                    pub fn #fn_name<'cursor, 'tree>(
+                        node: &::tree_sitter::Node<'tree>,
+                        cursor: &'cursor mut ::tree_sitter::TreeCursor<'tree>,
+                    ) -> impl Iterator<Item = ::tree_sitter::Node<'tree>> + 'cursor {
+                        #lookup
+                    }
+                }
+            } else {
+                let doc = format!(
+                    "Returns the `{}` child of the given `{}` node",
+                    field_name, node.r#type
+                );
+                let lookup = child_lookup(symbols.is_some(), quote! { node }, field_name);
+                quote! {
+                    #[doc=#doc]
+                    #[inline]
+                    pub fn #fn_name<'tree>(
+                        node: &::tree_sitter::Node<'tree>,
+                    ) -> Option<::tree_sitter::Node<'tree>> {
+                        #lookup
+                    }
+                }
+            }
+        })
+    });
+
+    quote! {
+        #field_ids
+        #(#accessors)*
+    }
+}
+
+/// Looks up the single child in a field, by id if `by_id` is set.
+pub fn child_lookup(by_id: bool, node: TokenStream, field_name: &str) -> TokenStream {
+    if by_id {
+        let const_name = field_const(field_name);
+        quote! { #node.child_by_field_id(fields::#const_name) }
+    } else {
+        quote! { #node.child_by_field_name(#field_name) }
+    }
+}
+
+/// Iterates over the children in a field using a `cursor` in scope, by id if `by_id` is set.
+pub fn children_lookup(by_id: bool, node: TokenStream, field_name: &str) -> TokenStream {
+    if by_id {
+        let const_name = field_const(field_name);
+        quote! { #node.children_by_field_id(fields::#const_name, cursor) }
+    } else {
+        quote! { #node.children_by_field_name(#field_name, cursor) }
+    }
+}
+
+/// The constant in the `fields` module that holds the id of a field.
+pub fn field_const(field_name: &str) -> proc_macro2::Ident {
+    format_ident!("{}", sanitize_identifier(field_name).to_uppercase())
+}
@@ -0,0 +1,492 @@
+//! Generates the `Ast` of the support module, a tree lowered into flat arrays.
+//!
+//! Nodes are stored in document order, so the children of a node follow it directly and the
+//! end of its subtree is the only link that has to be kept besides its parent. Tokens are left
+//! out, except for those in a field, since everything else about them follows from their parent.
+//!
+//! The same arrays, laid out one after the other in a byte buffer, are the serialized form of an
+//! `Ast`, which an `AstView` reads in place, so a tree cached in a file can be memory mapped and
+//! used without being parsed or copied. Kind and field ids take one byte each in the buffer where
+//! the grammar has few enough of them.
+
+use crate::accessors::field_const;
+use crate::node_types::Node;
+use crate::sanitize_identifier;
+use crate::symbols::SymbolTable;
+use proc_macro2::TokenStream;
+use quote::{format_ident, quote};
+
+/// The width in bytes of an id in the serialized arrays, given the largest one.
+fn id_width(max: usize) -> usize {
+    if max <= u8::MAX as usize {
+        1
+    } else {
+        2
+    }
+}
+
+/// Reads the id at index `i` of the array starting at `offset` in `self.bytes`.
+fn read_id(width: usize, offset: TokenStream) -> TokenStream {
+    match width {
+        1 => quote! { self.bytes[#offset + i] as u16 },
+        _ => quote! {
+            u16::from_le_bytes([self.bytes[#offset + 2 * i], self.bytes[#offset + 2 * i + 1]])
+        },
+    }
+}
+
+/// A hash of the symbol and field tables, which a serialized `Ast` carries in its header so that
+/// a buffer written for another grammar, or another version of this one, is rejected.
+fn fingerprint(symbols: &SymbolTable) -> u64 {
+    let mut hash: u64 = 0xcbf2_9ce4_8422_2325;
+    let mut write = |bytes: &[u8]| {
+        for &byte in bytes {
+            hash ^= byte as u64;
+            hash = hash.wrapping_mul(0x0000_0100_0000_01b3);
+        }
+    };
+    for symbol in &symbols.symbols {
+        write(&symbol.id.to_le_bytes());
+        write(&[symbol.named as u8]);
+        write(symbol.name.as_bytes());
+        write(&[0]);
+    }
+    write(&[0xff]);
+    for (id, name) in &symbols.fields {
+        write(&id.to_le_bytes());
+        write(name.as_bytes());
+        write(&[0]);
+    }
+    hash
+}
+
+pub fn ast(nodes: &[Node], symbols: &SymbolTable) -> TokenStream {
+    let accessors = typed_accessors(nodes, symbols);
+    let max_kind = symbols
+        .symbols
+        .iter()
+        .map(|s| s.id as usize)
+        .max()
+        .unwrap_or(0);
+    let max_field = symbols
+        .fields
+        .iter()
+        .map(|f| f.0 as usize)
+        .max()
+        .unwrap_or(0);
+    let kind_width = id_width(max_kind);
+    let field_width = id_width(max_field);
+    let write_kind = match kind_width {
+        1 => quote! { bytes.push(kind as u8) },
+        _ => quote! { bytes.extend_from_slice(&kind.to_le_bytes()) },
+    };
+    let write_field = match field_width {
+        1 => quote! { bytes.push(field as u8) },
+        _ => quote! { bytes.extend_from_slice(&field.to_le_bytes()) },
+    };
+    let read_kind = read_id(kind_width, quote! { self.offsets[5] });
+    let read_field = read_id(field_width, quote! { self.offsets[4] });
+    let kind_width = kind_width as u32;
+    let field_width = field_width as u32;
+    let ast = lowered(&accessors);
+    let fingerprint = fingerprint(symbols);
+
+    quote! {
+        #ast
+
+        impl Ast {
+            const MAGIC: [u8; 4] = *b"TSVA";
+            const VERSION: u32 = 2;
+            const FINGERPRINT: u64 = #fingerprint;
+            const HEADER_LEN: usize = 28;
+
+            /// The start of each array in a buffer of `len` nodes: starts, ends, parents and
+            /// subtree ends as `u32`s, then fields and kinds, followed by the total size.
+            fn layout(len: usize) -> [usize; 7] {
+                let mut offsets = [Self::HEADER_LEN; 7];
+                let widths = [4, 4, 4, 4, #field_width as usize, #kind_width as usize];
+                for (i, width) in widths.iter().enumerate() {
+                    offsets[i + 1] = offsets[i] + width * len;
+                }
+                offsets
+            }
+
+            /// Serializes the `Ast` into a buffer that `AstView::new` reads back in place.
+            /// Numbers are little endian.
+            pub fn to_bytes(&self) -> Vec<u8> {
+                let mut bytes = Vec::with_capacity(Self::layout(self.len())[6]);
+                bytes.extend_from_slice(&Self::MAGIC);
+                for header in [Self::VERSION, self.len() as u32, #kind_width, #field_width] {
+                    bytes.extend_from_slice(&header.to_le_bytes());
+                }
+                bytes.extend_from_slice(&Self::FINGERPRINT.to_le_bytes());
+                for array in [&self.starts, &self.ends, &self.parents, &self.subtree_ends] {
+                    for value in array {
+                        bytes.extend_from_slice(&value.to_le_bytes());
+                    }
+                }
+                for &field in &self.fields {
+                    #write_field;
+                }
+                for &kind in &self.kinds {
+                    #write_kind;
+                }
+                bytes
+            }
+        }
+
+        /// An [`Ast`] serialized with `Ast::to_bytes`, read in place from a buffer such as a
+        /// memory map. It has the accessors of an `Ast`, so code written against one runs on
+        /// the other.
+        #[derive(Clone, Copy, Debug)]
+        pub struct AstView<'a> {
+            bytes: &'a [u8],
+            len: usize,
+            offsets: [usize; 7],
+        }
+
+        impl<'a> AstView<'a> {
+            /// Checks that `bytes` were written by `Ast::to_bytes` for the same grammar, by a
+            /// fingerprint of its symbol and field tables, and that their size and links are
+            /// consistent, so that a corrupt buffer cannot make the accessors panic or loop on the ids
+            /// the view hands out. The links are checked in one pass over the nodes; kinds, fields
+            /// and ranges are not. An empty buffer is valid and has no `root()`.
+            pub fn new(bytes: &'a [u8]) -> ::std::io::Result<Self> {
+                let invalid = |message: &str| {
+                    ::std::io::Error::new(::std::io::ErrorKind::InvalidData, message.to_owned())
+                };
+                let header = |i: usize| {
+                    bytes
+                        .get(4 + 4 * i..8 + 4 * i)
+                        .map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+                };
+                if bytes.get(..4) != Some(&Ast::MAGIC[..]) {
+                    return Err(invalid("not a serialized Ast"));
+                }
+                if header(0) != Some(Ast::VERSION) {
+                    return Err(invalid("unsupported Ast version"));
+                }
+                let fingerprint = bytes.get(20..28).map(|b| {
+                    u64::from_le_bytes([b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7]])
+                });
+                if (header(2), header(3), fingerprint)
+                    != (Some(#kind_width), Some(#field_width), Some(Ast::FINGERPRINT))
+                {
+                    return Err(invalid("Ast was serialized for another grammar"));
+                }
+                let len = header(1).ok_or_else(|| invalid("truncated Ast"))? as usize;
+                let offsets = Ast::layout(len);
+                if bytes.len() != offsets[6] {
+                    return Err(invalid("truncated Ast"));
+                }
+                let view = AstView {
+                    bytes,
+                    len,
+                    offsets,
+                };
+                // Every subtree has to end after its node and within its parent's, which comes
+                // before it, so that `children` only moves forward and stays in the buffer.
+                for i in 0..len {
+                    let end = view.read_u32(3, i) as usize;
+                    let linked = match view.read_u32(2, i) {
+                        Ast::NONE => i == 0,
+                        parent => {
+                            (parent as usize) < i
+                                && end <= view.read_u32(3, parent as usize) as usize
+                        }
+                    };
+                    if end <= i || end > len || (i == 0 && end != len) || !linked {
+                        return Err(invalid("corrupt Ast"));
+                    }
+                }
+                Ok(view)
+            }
+
+            #[inline]
+            fn read_u32(&self, array: usize, i: usize) -> u32 {
+                let at = self.offsets[array] + 4 * i;
+                let b = &self.bytes[at..at + 4];
+                u32::from_le_bytes([b[0], b[1], b[2], b[3]])
+            }
+
+            #[inline]
+            fn subtree_end(&self, id: AstId) -> u32 {
+                self.read_u32(3, id.0 as usize)
+            }
+
+            #[inline]
+            fn raw_field(&self, id: AstId) -> u16 {
+                let i = id.0 as usize;
+                #read_field
+            }
+
+            /// The node the `Ast` was built from, `None` if it is empty, as a default `Ast` is.
+            pub fn root(&self) -> Option<AstId> {
+                (!self.is_empty()).then(|| AstId(0))
+            }
+
+            /// The number of nodes.
+            pub fn len(&self) -> usize {
+                self.len
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.len == 0
+            }
+
+            /// The numeric kind of a node, as returned by `Node::kind_id()`.
+            #[inline]
+            pub fn kind_id(&self, id: AstId) -> u16 {
+                let i = id.0 as usize;
+                #read_kind
+            }
+
+            #[inline]
+            pub fn byte_range(&self, id: AstId) -> ::std::ops::Range<usize> {
+                let i = id.0 as usize;
+                self.read_u32(0, i) as usize..self.read_u32(1, i) as usize
+            }
+
+            #[inline]
+            pub fn parent(&self, id: AstId) -> Option<AstId> {
+                match self.read_u32(2, id.0 as usize) {
+                    Ast::NONE => None,
+                    parent => Some(AstId(parent)),
+                }
+            }
+
+            #accessors
+        }
+    }
+}
+
+/// The navigation shared by `Ast` and `AstView`, on top of `subtree_end` and `raw_field`, and
+/// the checks and field accessors of the node types, on top of `kind_id`.
+fn typed_accessors(nodes: &[Node], symbols: &SymbolTable) -> TokenStream {
+    let kind_checks = nodes.iter().filter(|node| node.named).map(|node| {
+        let ids = symbols.kind_ids(&node.r#type, true);
+        let fn_name = format_ident!("is_{}", sanitize_identifier(&node.r#type));
+        let doc = format!("Whether the given node is a `{}`", node.r#type);
+        // Supertypes never appear in a tree, so they have no ids and always fail the check.
+        let check = if ids.is_empty() {
+            quote! { false }
+        } else {
+            quote! { matches!(self.kind_id(id), #(#ids)|*) }
+        };
+        quote! {
+            #[doc=#doc]
+            #[inline]
+            pub fn #fn_name(&self, id: AstId) -> bool {
+                #check
+            }
+        }
+    });
+
+    let field_accessors = nodes.iter().flat_map(|node| {
+        node.fields.iter().map(move |(field_name, field)| {
+            let fn_name = format_ident!(
+                "{}_{}",
+                sanitize_identifier(&node.r#type),
+                sanitize_identifier(field_name)
+            );
+            let const_name = field_const(field_name);
+            if field.multiple {
+                let doc = format!(
+                    "Iterates over the `{}` children of the given `{}` node",
+                    field_name, node.r#type
+                );
+                quote! {
+                    #[doc=#doc]
+                    #[inline]
+                    pub fn #fn_name(&self, id: AstId) -> impl Iterator<Item = AstId> + '_ {
+                        self.children(id)
+                            .filter(move |child| self.raw_field(*child) == fields::#const_name)
+                    }
+                }
+            } else {
+                let doc = format!(
+                    "Returns the `{}` child of the given `{}` node",
+                    field_name, node.r#type
+                );
+                quote! {
+                    #[doc=#doc]
+                    #[inline]
+                    pub fn #fn_name(&self, id: AstId) -> Option<AstId> {
+                        self.child_by_field_id(id, fields::#const_name)
+                    }
+                }
+            }
+        })
+    });
+
+    quote! {
+        /// The id of the field a node is in within its parent.
+        #[inline]
+        pub fn field_id(&self, id: AstId) -> Option<u16> {
+            match self.raw_field(id) {
+                0 => None,
+                field => Some(field),
+            }
+        }
+
+        /// Iterates over the kept children of a node, in order.
+        #[inline]
+        pub fn children(&self, id: AstId) -> impl Iterator<Item = AstId> + '_ {
+            let end = self.subtree_end(id);
+            let mut next = id.0 + 1;
+            ::std::iter::from_fn(move || {
+                (next < end).then(|| {
+                    let child = next;
+                    next = self.subtree_end(AstId(child));
+                    AstId(child)
+                })
+            })
+        }
+
+        /// Returns the first child of a node in the given field.
+        #[inline]
+        pub fn child_by_field_id(&self, id: AstId, field_id: u16) -> Option<AstId> {
+            self.children(id)
+                .find(|child| self.raw_field(*child) == field_id)
+        }
+
+        #(#kind_checks)*
+        #(#field_accessors)*
+    }
+}
+
+/// The `Ast` itself and how a tree is lowered into it.
+fn lowered(accessors: &TokenStream) -> TokenStream {
+    quote! {
+        /// The index of a node in an [`Ast`].
+        #[derive(Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash, Debug)]
+        pub struct AstId(pub u32);
+
+        /// A tree lowered into one array per property, indexed by [`AstId`].
+        ///
+        /// Named nodes and tokens in a field are kept, in document order. Building one does not
+        /// allocate per node, and `rebuild` reuses the arrays of an earlier tree so that lowering
+        /// many files in a row only allocates until they fit the largest.
+        #[derive(Clone, Default, Debug)]
+        pub struct Ast {
+            kinds: Vec<u16>,
+            fields: Vec<u16>,
+            starts: Vec<u32>,
+            ends: Vec<u32>,
+            parents: Vec<u32>,
+            subtree_ends: Vec<u32>,
+            levels: Vec<u32>,
+        }
+
+        impl Ast {
+            const NONE: u32 = u32::MAX;
+
+            /// Lowers the subtree under `node`.
+            pub fn build(node: &::tree_sitter::Node) -> Self {
+                let mut ast = Ast::default();
+                ast.rebuild(node);
+                ast
+            }
+
+            /// Replaces the contents with the subtree under `node`, in a single pass of a
+            /// `TreeCursor`.
+            pub fn rebuild(&mut self, node: &::tree_sitter::Node) {
+                <u32 as ::std::convert::TryFrom<usize>>::try_from(node.end_byte())
+                    .expect("source is too large for an Ast");
+                self.kinds.clear();
+                self.fields.clear();
+                self.starts.clear();
+                self.ends.clear();
+                self.parents.clear();
+                self.subtree_ends.clear();
+
+                // `levels` has an entry for every node on the path from `node` to the cursor,
+                // the index of the node if it was kept and `NONE` otherwise.
+                let mut levels = ::std::mem::take(&mut self.levels);
+                levels.clear();
+                let mut parent = Self::NONE;
+                let mut cursor = node.walk();
+                loop {
+                    let node = cursor.node();
+                    let field = cursor.field_id();
+                    if levels.is_empty() || node.is_named() || field.is_some() {
+                        let id = self.kinds.len() as u32;
+                        self.kinds.push(node.kind_id());
+                        self.fields.push(field.unwrap_or(0));
+                        self.starts.push(node.start_byte() as u32);
+                        self.ends.push(node.end_byte() as u32);
+                        self.parents.push(parent);
+                        self.subtree_ends.push(id + 1);
+                        levels.push(id);
+                        parent = id;
+                    } else {
+                        levels.push(Self::NONE);
+                    }
+                    if cursor.goto_first_child() {
+                        continue;
+                    }
+                    loop {
+                        let id = levels.pop().expect("unbalanced Ast levels");
+                        if id != Self::NONE {
+                            self.subtree_ends[id as usize] = self.kinds.len() as u32;
+                            parent = self.parents[id as usize];
+                        }
+                        if levels.is_empty() {
+                            self.levels = levels;
+                            return;
+                        }
+                        if cursor.goto_next_sibling() {
+                            break;
+                        }
+                        cursor.goto_parent();
+                    }
+                }
+            }
+
+            /// The node the `Ast` was built from, `None` if it is empty, as a default `Ast` is.
+            pub fn root(&self) -> Option<AstId> {
+                (!self.is_empty()).then(|| AstId(0))
+            }
+
+            /// The number of nodes.
+            pub fn len(&self) -> usize {
+                self.kinds.len()
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.kinds.is_empty()
+            }
+
+            /// The numeric kind of a node, as returned by `Node::kind_id()`.
+            #[inline]
+            pub fn kind_id(&self, id: AstId) -> u16 {
+                self.kinds[id.0 as usize]
+            }
+
+            #[inline]
+            fn subtree_end(&self, id: AstId) -> u32 {
+                self.subtree_ends[id.0 as usize]
+            }
+
+            #[inline]
+            fn raw_field(&self, id: AstId) -> u16 {
+                self.fields[id.0 as usize]
+            }
+
+            #[inline]
+            pub fn byte_range(&self, id: AstId) -> ::std::ops::Range<usize> {
+                self.starts[id.0 as usize] as usize..self.ends[id.0 as usize] as usize
+            }
+
+            #[inline]
+            pub fn parent(&self, id: AstId) -> Option<AstId> {
+                match self.parents[id.0 as usize] {
+                    Self::NONE => None,
+                    parent => Some(AstId(parent)),
+                }
+            }
+
+            #accessors
+        }
+    }
+}
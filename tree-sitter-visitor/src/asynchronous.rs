@@ -0,0 +1,97 @@
+//! The `async` counterpart of `fold_iterative`, for visitors that wait on I/O halfway through.
+//!
+//! An `async fn` that awaits itself for every child needs a boxed future per level, so instead the
+//! driver keeps the same explicit stack as `fold_iterative` and awaits one `async_fold_<node
+//! type>` after the other in post-order. The future of the node being folded is stored inline in
+//! that of the driver, which makes a whole tree one future of constant size.
+
+use syn::{parse_quote, TraitItem};
+
+/// The per-type method, which defaults to the synchronous `fold_<node type>`.
+pub fn fold_fn(
+    name: &syn::Ident,
+    fold_name: &syn::Ident,
+    param: &proc_macro2::TokenStream,
+    doc_name: &str,
+) -> TraitItem {
+    let doc = format!(
+        "Folds a `{}` node given the results of its named children, during `async_fold_iterative`",
+        doc_name
+    );
+    parse_quote! {
+        #[doc=#doc]
+        #[allow(async_fn_in_trait)]
+        async fn #name(
+            &mut self,
+            node: #param,
+            children: ::std::vec::Drain<'_, Self::ReturnType>,
+        ) -> Self::ReturnType {
+            self.#fold_name(node, children)
+        }
+    }
+}
+
+pub fn dispatch_fn(
+    kind: &proc_macro2::TokenStream,
+    arms: &[proc_macro2::TokenStream],
+) -> TraitItem {
+    parse_quote! {
+        #[doc=r"Dispatches to the `async_fold_<node type>` method of a named node of any type."]
+        #[allow(async_fn_in_trait)]
+        async fn async_fold(
+            &mut self,
+            node: &::tree_sitter::Node<'_>,
+            children: ::std::vec::Drain<'_, Self::ReturnType>,
+        ) -> Self::ReturnType {
+            match #kind {
+                #(#arms,)*
+                _ => self.fold_default(node, children)
+            }
+        }
+    }
+}
+
+pub fn async_fold_iterative(module: &syn::Ident) -> TraitItem {
+    parse_quote! {
+        #[doc=r"Folds the subtree under `node` like `fold_iterative`, awaiting `async_fold_<node"]
+        #[doc=r"type>` on every named node. No future is allocated per node, so the returned one"]
+        #[doc=r"can be awaited on any executor; it is not `Send`, since `Node` is not."]
+        #[allow(async_fn_in_trait)]
+        async fn async_fold_iterative(
+            &mut self,
+            node: &::tree_sitter::Node<'_>,
+            stack: &mut #module::FoldStack<Self::ReturnType>,
+        ) -> Self::ReturnType {
+            assert!(node.is_named(), "cannot fold anonymous node: {}", node.kind());
+            stack.frames.clear();
+            stack.results.clear();
+            let mut cursor = node.walk();
+            let mut depth = 0usize;
+            loop {
+                if cursor.node().is_named() {
+                    stack.frames.push(stack.results.len());
+                    if cursor.goto_first_child() {
+                        depth += 1;
+                        continue;
+                    }
+                }
+                loop {
+                    let node = cursor.node();
+                    if node.is_named() {
+                        let start = stack.frames.pop().expect("unbalanced fold stack");
+                        let result = self.async_fold(&node, stack.results.drain(start..)).await;
+                        stack.results.push(result);
+                    }
+                    if depth == 0 {
+                        return stack.results.pop().expect("unbalanced fold stack");
+                    }
+                    if cursor.goto_next_sibling() {
+                        break;
+                    }
+                    cursor.goto_parent();
+                    depth -= 1;
+                }
+            }
+        }
+    }
+}
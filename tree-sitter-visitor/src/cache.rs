@@ -0,0 +1,47 @@
+//! Keeps what was parsed out of the grammar files between expansions.
+//!
+//! The compiler and rust-analyzer load a proc macro once and expand every use of it in the same
+//! process, so several traits over one grammar, or rust-analyzer expanding the same trait again
+//! after each edit, only pay for deserializing `node-types.json` and scanning `parser.c` once.
+//! Entries are keyed by the hash of the file contents, so an edited grammar is picked up.
+
+use std::any::{Any, TypeId};
+use std::collections::hash_map::DefaultHasher;
+use std::collections::BTreeMap;
+use std::hash::{Hash, Hasher};
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex};
+
+type Entry = (u64, Arc<dyn Any + Send + Sync>);
+
+static PARSED: Mutex<BTreeMap<(PathBuf, TypeId), Entry>> = Mutex::new(BTreeMap::new());
+
+/// Reads the file at `path` in one go and returns what `parse` made of it, reusing the result of
+/// an earlier expansion if the file has not changed since.
+pub fn load<T, F>(path: &Path, parse: F) -> std::io::Result<Arc<T>>
+where
+    T: Any + Send + Sync,
+    F: FnOnce(&str) -> T,
+{
+    let source = std::fs::read_to_string(path)?;
+    let mut hasher = DefaultHasher::new();
+    source.hash(&mut hasher);
+    let hash = hasher.finish();
+
+    let key = (path.to_owned(), TypeId::of::<T>());
+    let cached = match PARSED.lock().unwrap().get(&key) {
+        Some((cached_hash, value)) if *cached_hash == hash => value.clone().downcast().ok(),
+        _ => None,
+    };
+    if let Some(value) = cached {
+        return Ok(value);
+    }
+
+    // Parsing can panic on a malformed file, so it must not happen while holding the lock.
+    let value = Arc::new(parse(&source));
+    PARSED
+        .lock()
+        .unwrap()
+        .insert(key, (hash, value.clone() as Arc<dyn Any + Send + Sync>));
+    Ok(value)
+}
@@ -0,0 +1,153 @@
+//! Collects the named children of a node without allocating.
+//!
+//! `node-types.json` says how many children every field and `children` of a node type can
+//! hold. When all of them hold exactly one named node or only anonymous tokens, a node of that
+//! type always has the same number of named children, and they fit in an array; otherwise they
+//! go into a vector that keeps the first few on the stack.
+
+use crate::node_types::Node;
+use crate::sanitize_identifier;
+use proc_macro2::TokenStream;
+use quote::{format_ident, quote};
+
+/// How many named children a node of the given type has, if that is always the same. Extras,
+/// such as comments, are not counted, since they can appear anywhere, and neither are fields
+/// that only hold anonymous tokens, like the `operator` of a binary expression.
+fn arity(node: &Node) -> Option<usize> {
+    node.fields
+        .values()
+        .chain(&node.children)
+        .map(|field| {
+            let named = field.types.iter().filter(|r#type| r#type.named).count();
+            match named {
+                0 => Some(0),
+                // A field that can hold a token or a named node has no fixed count either.
+                _ if named == field.types.len() && field.required && !field.multiple => Some(1),
+                _ => None,
+            }
+        })
+        .sum()
+}
+
+pub fn children_helpers(nodes: &[Node]) -> TokenStream {
+    let per_type = nodes
+        .iter()
+        .filter(|node| node.named && !node.is_supertype())
+        .filter(|node| !node.fields.is_empty() || node.children.is_some())
+        .map(|node| {
+            let fn_name = format_ident!("children_of_{}", sanitize_identifier(&node.r#type));
+            match arity(node) {
+                Some(arity) => {
+                    let doc = format!(
+                        "The {} named children of the given `{}` node, `None` if it has a different \
+                         number because of a parse error",
+                        arity, node.r#type
+                    );
+                    quote! {
+                        #[doc=#doc]
+                        #[inline]
+                        pub fn #fn_name<'tree>(
+                            node: &::tree_sitter::Node<'tree>,
+                        ) -> Option<[::tree_sitter::Node<'tree>; #arity]> {
+                            named_children_array(node)
+                        }
+                    }
+                }
+                None => {
+                    let doc = format!("The named children of the given `{}` node", node.r#type);
+                    quote! {
+                        #[doc=#doc]
+                        #[inline]
+                        pub fn #fn_name<'tree>(
+                            node: &::tree_sitter::Node<'tree>,
+                        ) -> SmallChildren<'tree> {
+                            SmallChildren::new(node)
+                        }
+                    }
+                }
+            }
+        });
+
+    quote! {
+        /// The named children of `node` other than extras, if there are exactly `N` of them.
+        #[inline]
+        pub fn named_children_array<'tree, const N: usize>(
+            node: &::tree_sitter::Node<'tree>,
+        ) -> Option<[::tree_sitter::Node<'tree>; N]> {
+            let mut children = [*node; N];
+            let mut len = 0;
+            for i in 0..node.child_count() {
+                let child = node.child(i)?;
+                if child.is_named() && !child.is_extra() {
+                    *children.get_mut(len)? = child;
+                    len += 1;
+                }
+            }
+            (len == N).then(|| children)
+        }
+
+        /// How many children a `SmallChildren` holds before moving them to the heap.
+        pub const INLINE_CHILDREN: usize = 8;
+
+        /// The named children of a node other than extras, the first `INLINE_CHILDREN` of them
+        /// stored inline and all of them on the heap past that.
+        #[derive(Clone, Debug)]
+        pub struct SmallChildren<'tree> {
+            inline: [::tree_sitter::Node<'tree>; INLINE_CHILDREN],
+            len: usize,
+            spilled: Vec<::tree_sitter::Node<'tree>>,
+        }
+
+        impl<'tree> SmallChildren<'tree> {
+            pub fn new(node: &::tree_sitter::Node<'tree>) -> Self {
+                let mut children = SmallChildren {
+                    inline: [*node; INLINE_CHILDREN],
+                    len: 0,
+                    spilled: Vec::new(),
+                };
+                let keep = |child: &::tree_sitter::Node| child.is_named() && !child.is_extra();
+                // Looking a child up by index walks its preceding siblings, so long lists of
+                // children are read with a cursor instead, which allocates a little itself.
+                let count = node.child_count();
+                if count <= 2 * INLINE_CHILDREN {
+                    for child in (0..count).filter_map(|i| node.child(i)).filter(keep) {
+                        children.push(child);
+                    }
+                } else {
+                    let mut cursor = node.walk();
+                    for child in node.children(&mut cursor).filter(keep) {
+                        children.push(child);
+                    }
+                }
+                children
+            }
+
+            fn push(&mut self, child: ::tree_sitter::Node<'tree>) {
+                if !self.spilled.is_empty() {
+                    self.spilled.push(child);
+                } else if self.len < INLINE_CHILDREN {
+                    self.inline[self.len] = child;
+                    self.len += 1;
+                } else {
+                    self.spilled.reserve(2 * INLINE_CHILDREN);
+                    self.spilled.extend_from_slice(&self.inline);
+                    self.spilled.push(child);
+                }
+            }
+        }
+
+        impl<'tree> ::std::ops::Deref for SmallChildren<'tree> {
+            type Target = [::tree_sitter::Node<'tree>];
+
+            fn deref(&self) -> &Self::Target {
+                if self.spilled.is_empty() {
+                    &self.inline[..self.len]
+                } else {
+                    &self.spilled
+                }
+            }
+        }
+
+        #(#per_type)*
+    }
+}
@@ -0,0 +1,133 @@
+//! Parsing and reading node text from input that is not one contiguous `String`.
+//!
+//! The support module gets a `Chunked` trait for input that can be read piece by piece, which
+//! anything that is `AsRef<[u8]>` implements, memory maps included, and a `ChunkedText` that
+//! reads a stream into fixed-size pages. Trees are parsed from either through
+//! `Parser::parse_with`, and node text is borrowed from them where it does not straddle pages.
+
+pub fn support() -> proc_macro2::TokenStream {
+    quote::quote! {
+        /// Input that can be handed to the parser, and read back, in pieces.
+        pub trait Chunked {
+            /// The bytes from `offset` up to the end of the piece that holds it, empty at or past
+            /// the end of the input.
+            fn chunk(&self, offset: usize) -> &[u8];
+
+            /// The bytes of `range`, borrowed if they are all in the same piece.
+            fn slice(&self, range: ::std::ops::Range<usize>) -> ::std::borrow::Cow<'_, [u8]> {
+                let first = self.chunk(range.start);
+                if first.len() >= range.len() {
+                    return ::std::borrow::Cow::Borrowed(&first[..range.len()]);
+                }
+                let mut bytes = Vec::with_capacity(range.len());
+                while bytes.len() < range.len() {
+                    let chunk = self.chunk(range.start + bytes.len());
+                    assert!(!chunk.is_empty(), "range is past the end of the input");
+                    let wanted = (range.len() - bytes.len()).min(chunk.len());
+                    bytes.extend_from_slice(&chunk[..wanted]);
+                }
+                ::std::borrow::Cow::Owned(bytes)
+            }
+
+            /// The bytes of `node`, borrowed if they are all in the same piece.
+            fn bytes(&self, node: &::tree_sitter::Node) -> ::std::borrow::Cow<'_, [u8]> {
+                self.slice(node.byte_range())
+            }
+
+            /// The text of `node`, borrowed if it is all in the same piece. Invalid UTF-8 is
+            /// replaced with `U+FFFD`.
+            fn text(&self, node: &::tree_sitter::Node) -> ::std::borrow::Cow<'_, str> {
+                match self.bytes(node) {
+                    ::std::borrow::Cow::Borrowed(bytes) => String::from_utf8_lossy(bytes),
+                    ::std::borrow::Cow::Owned(bytes) => match String::from_utf8(bytes) {
+                        Ok(text) => ::std::borrow::Cow::Owned(text),
+                        Err(error) => ::std::borrow::Cow::Owned(
+                            String::from_utf8_lossy(error.as_bytes()).into_owned(),
+                        ),
+                    },
+                }
+            }
+        }
+
+        impl<T: AsRef<[u8]> + ?Sized> Chunked for T {
+            #[inline]
+            fn chunk(&self, offset: usize) -> &[u8] {
+                self.as_ref().get(offset..).unwrap_or(&[])
+            }
+        }
+
+        /// A stream read into pages of equal size, so that large inputs are never copied into,
+        /// or grown as, a single buffer.
+        pub struct ChunkedText {
+            pages: Vec<Vec<u8>>,
+            page_size: usize,
+            len: usize,
+        }
+
+        impl ChunkedText {
+            pub const DEFAULT_PAGE_SIZE: usize = 1 << 20;
+
+            /// Reads all of `reader` into pages of `DEFAULT_PAGE_SIZE` bytes.
+            pub fn read(reader: impl ::std::io::Read) -> ::std::io::Result<Self> {
+                Self::read_with_page_size(reader, Self::DEFAULT_PAGE_SIZE)
+            }
+
+            /// Reads all of `reader` into pages of `page_size` bytes.
+            pub fn read_with_page_size(
+                mut reader: impl ::std::io::Read,
+                page_size: usize,
+            ) -> ::std::io::Result<Self> {
+                assert!(page_size > 0, "pages cannot be empty");
+                let mut text = ChunkedText {
+                    pages: Vec::new(),
+                    page_size,
+                    len: 0,
+                };
+                loop {
+                    let mut page = Vec::with_capacity(page_size);
+                    ::std::io::Read::read_to_end(
+                        &mut ::std::io::Read::take(&mut reader, page_size as u64),
+                        &mut page,
+                    )?;
+                    text.len += page.len();
+                    let full = page.len() == page_size;
+                    if !page.is_empty() {
+                        text.pages.push(page);
+                    }
+                    if !full {
+                        return Ok(text);
+                    }
+                }
+            }
+
+            /// The length of the input in bytes.
+            pub fn len(&self) -> usize {
+                self.len
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.len == 0
+            }
+        }
+
+        impl Chunked for ChunkedText {
+            #[inline]
+            fn chunk(&self, offset: usize) -> &[u8] {
+                match self.pages.get(offset / self.page_size) {
+                    // The last page may be partial, and `offset` past its end.
+                    Some(page) => page.get(offset % self.page_size..).unwrap_or(&[]),
+                    None => &[],
+                }
+            }
+        }
+
+        /// Parses `text` piece by piece through `Parser::parse_with`.
+        pub fn parse_chunked<T: Chunked + ?Sized>(
+            parser: &mut ::tree_sitter::Parser,
+            text: &T,
+            old_tree: Option<&::tree_sitter::Tree>,
+        ) -> Option<::tree_sitter::Tree> {
+            parser.parse_with(&mut |offset, _| text.chunk(offset), old_tree)
+        }
+    }
+}
@@ -0,0 +1,78 @@
+//! How generated code tells node types apart at runtime.
+
+use crate::node_types::Node;
+use crate::symbols::SymbolTable;
+use proc_macro2::TokenStream;
+use quote::quote;
+
+/// Matches nodes either by `Node::kind()` or, when the symbol table is known, by
+/// `Node::kind_id()`.
+#[derive(Clone, Copy)]
+pub struct Kinds<'a> {
+    symbols: Option<&'a SymbolTable>,
+}
+
+impl<'a> Kinds<'a> {
+    pub fn new(symbols: Option<&'a SymbolTable>) -> Self {
+        Kinds { symbols }
+    }
+
+    pub fn by_id(&self) -> bool {
+        self.symbols.is_some()
+    }
+
+    /// The expression the generated `match` inspects for the given node expression.
+    pub fn subject(&self, node: TokenStream) -> TokenStream {
+        match self.symbols {
+            // A match over dense integer constants is lowered to a jump table, so dispatching by
+            // id costs a single indexed branch regardless of how many node types there are.
+            Some(_) => quote! { #node.kind_id() },
+            None => quote! { #node.kind() },
+        }
+    }
+
+    /// The pattern that matches a node of the given type, `None` if the parser has no such symbol.
+    pub fn pattern(&self, node: &Node) -> Option<TokenStream> {
+        match self.symbols {
+            Some(symbols) => {
+                let ids = symbols.kind_ids(&node.r#type, node.named);
+                (!ids.is_empty()).then(|| quote! { #(#ids)|* })
+            }
+            None => {
+                let name = &node.r#type;
+                Some(quote! { #name })
+            }
+        }
+    }
+
+    /// A boolean expression that is true when the node expression has one of the given types.
+    /// Names alone do not tell named and anonymous types apart, so without ids it checks that too.
+    pub fn test(&self, node: TokenStream, types: &[&Node]) -> TokenStream {
+        if self.by_id() {
+            let patterns: Vec<_> = types.iter().filter_map(|node| self.pattern(node)).collect();
+            if patterns.is_empty() {
+                return quote! { false };
+            }
+            return quote! { matches!(#node.kind_id(), #(#patterns)|*) };
+        }
+        let group = |named: bool| {
+            let names: Vec<_> = types
+                .iter()
+                .filter(|node| node.named == named)
+                .map(|node| &node.r#type)
+                .collect();
+            let is_named = if named {
+                quote! { #node.is_named() }
+            } else {
+                quote! { !#node.is_named() }
+            };
+            (!names.is_empty())
+                .then(|| quote! { (#is_named && matches!(#node.kind(), #(#names)|*)) })
+        };
+        match (group(true), group(false)) {
+            (Some(named), Some(anonymous)) => quote! { (#named || #anonymous) },
+            (Some(group), None) | (None, Some(group)) => group,
+            (None, None) => quote! { false },
+        }
+    }
+}
@@ -0,0 +1,254 @@
+//! Provided trait methods that drive a visitor over whole trees or batches of sources.
+//!
+//! None of these depend on the grammar, they only build on `visit(...)` and friends.
+
+use syn::{parse_quote, TraitItem};
+
+/// Walks a subtree with a single cursor, calling the `enter`/`leave` hooks of every node.
+pub fn walk() -> TraitItem {
+    // The walker only ever moves the one cursor it was given, so a full pass is linear in the
+    // size of the tree and does not look up children by index or create a cursor per node.
+    parse_quote! {
+        #[doc=r"Walks the subtree under `cursor` in document order, calling `enter` on each node"]
+        #[doc=r"before its children and `leave` after them. The cursor is left where it started."]
+        fn walk(&mut self, cursor: &mut ::tree_sitter::TreeCursor) {
+            let mut depth = 0usize;
+            loop {
+                self.enter(&cursor.node());
+                if cursor.goto_first_child() {
+                    depth += 1;
+                    continue;
+                }
+                loop {
+                    self.leave(&cursor.node());
+                    if depth == 0 {
+                        return;
+                    }
+                    if cursor.goto_next_sibling() {
+                        break;
+                    }
+                    cursor.goto_parent();
+                    depth -= 1;
+                }
+            }
+        }
+    }
+}
+
+/// Like `walk`, but only enters the subtrees that can contain a node type of a `KindFilter`.
+pub fn walk_filtered(module: &syn::Ident) -> TraitItem {
+    parse_quote! {
+        #[doc=r"Walks the subtree under `cursor` like `walk`, but does not enter nodes that cannot"]
+        #[doc=r"contain any of the node types in `filter` according to `node-types.json`. Their"]
+        #[doc=r"`enter` and `leave` hooks are still called."]
+        fn walk_filtered(
+            &mut self,
+            cursor: &mut ::tree_sitter::TreeCursor,
+            filter: &#module::KindFilter,
+        ) {
+            let mut depth = 0usize;
+            loop {
+                let node = cursor.node();
+                self.enter(&node);
+                if filter.may_contain(&node) && cursor.goto_first_child() {
+                    depth += 1;
+                    continue;
+                }
+                loop {
+                    self.leave(&cursor.node());
+                    if depth == 0 {
+                        return;
+                    }
+                    if cursor.goto_next_sibling() {
+                        break;
+                    }
+                    cursor.goto_parent();
+                    depth -= 1;
+                }
+            }
+        }
+    }
+}
+
+/// Visits a sequence of already parsed trees with the same visitor.
+///
+/// `memoize` is the only mode with state of its own that depends on the tree, so `memoized`
+/// picks `visit_memoized` to keep the one table for the whole batch.
+pub fn visit_batch(memoized: bool) -> TraitItem {
+    let visit = if memoized {
+        quote::quote! { self.visit_memoized(&tree) }
+    } else {
+        quote::quote! { self.visit(&tree.root_node()) }
+    };
+    parse_quote! {
+        #[doc=r"Visits the tree of every `(source, tree)` pair in `batch` with this one visitor,"]
+        #[doc=r"calling `reset` and then `prepare` before each, and hands the pair back to `consume`"]
+        #[doc=r"along with the result. Everything the visitor owns keeps its allocations from one"]
+        #[doc=r"item to the next."]
+        fn visit_batch<S, I, P, C>(&mut self, batch: I, mut prepare: P, mut consume: C)
+        where
+            Self: Sized,
+            I: IntoIterator<Item = (S, ::tree_sitter::Tree)>,
+            P: FnMut(&mut Self, &S),
+            C: FnMut(S, ::tree_sitter::Tree, Self::ReturnType),
+        {
+            for (source, tree) in batch {
+                self.reset();
+                prepare(self, &source);
+                let result = #visit;
+                consume(source, tree, result);
+            }
+        }
+    }
+}
+
+/// Parses and visits many sources on all cores.
+///
+/// Every worker thread owns one `Parser` and one clone of the visitor for its whole lifetime, and
+/// claims the next unvisited source from a shared counter whenever it is done with the previous
+/// one, so uneven file sizes do not leave threads idle.
+pub fn visit_parallel() -> TraitItem {
+    parse_quote! {
+        #[doc=r"Parses and visits every source on its own clone of this visitor, using one worker"]
+        #[doc=r"thread per core that each reuse a single `Parser`. `reset` and then `prepare` are"]
+        #[doc=r"called before each source is visited, to point the visitor at it. The per-source"]
+        #[doc=r"results are combined with `reduce` in the order of `sources`; `None` is returned for"]
+        #[doc=r"no sources."]
+        fn visit_parallel<'s, S, P, R>(
+            &self,
+            language: ::tree_sitter::Language,
+            sources: &'s [S],
+            prepare: P,
+            reduce: R,
+        ) -> Option<Self::ReturnType>
+        where
+            Self: Clone + Send + Sized,
+            Self::ReturnType: Send,
+            S: AsRef<[u8]> + Sync,
+            P: Fn(&mut Self, &'s S) + Sync,
+            R: FnMut(Self::ReturnType, Self::ReturnType) -> Self::ReturnType,
+        {
+            let threads = ::std::thread::available_parallelism()
+                .map_or(1, |n| n.get())
+                .min(sources.len());
+            let next = ::std::sync::atomic::AtomicUsize::new(0);
+            let mut results: Vec<Option<Self::ReturnType>> =
+                (0..sources.len()).map(|_| None).collect();
+
+            ::std::thread::scope(|scope| {
+                let workers: Vec<_> = (0..threads)
+                    .map(|_| {
+                        let mut visitor = self.clone();
+                        let (next, prepare) = (&next, &prepare);
+                        scope.spawn(move || {
+                            let mut parser = ::tree_sitter::Parser::new();
+                            parser
+                                .set_language(language)
+                                .expect("could not set the language of the parser");
+                            let mut visited = Vec::new();
+                            loop {
+                                let index = next.fetch_add(1, ::std::sync::atomic::Ordering::Relaxed);
+                                let source = match sources.get(index) {
+                                    Some(source) => source,
+                                    None => break visited,
+                                };
+                                visitor.reset();
+                                prepare(&mut visitor, source);
+                                if let Some(tree) = parser.parse(source, None) {
+                                    visited.push((index, visitor.visit(&tree.root_node())));
+                                }
+                            }
+                        })
+                    })
+                    .collect();
+
+                for worker in workers {
+                    for (index, result) in worker.join().expect("visitor thread panicked") {
+                        results[index] = Some(result);
+                    }
+                }
+            });
+
+            results.into_iter().flatten().reduce(reduce)
+        }
+    }
+}
+
+/// Folds a subtree bottom-up without recursing, by calling `fold` on every named node with the
+/// results of its named children.
+pub fn fold_iterative(module: &syn::Ident) -> TraitItem {
+    // The only state is the cursor and the caller's `FoldStack`, whose two vectors keep their
+    // capacity between calls: the start of each open node's results in `frames`, and the results
+    // of the children visited so far in `results`. Depth is bounded by the heap, not the stack.
+    parse_quote! {
+        #[doc=r"Folds the subtree under `node` in post-order on an explicit stack, so that deeply"]
+        #[doc=r"nested trees cannot overflow the native one. `fold_<node type>` is called on every"]
+        #[doc=r"named node with the results of its named children, in order; anonymous nodes are"]
+        #[doc=r"skipped. Passing the same `stack` to every call reuses its allocations."]
+        fn fold_iterative(
+            &mut self,
+            node: &::tree_sitter::Node,
+            stack: &mut #module::FoldStack<Self::ReturnType>,
+        ) -> Self::ReturnType {
+            assert!(node.is_named(), "cannot fold anonymous node: {}", node.kind());
+            stack.frames.clear();
+            stack.results.clear();
+            let mut cursor = node.walk();
+            let mut depth = 0usize;
+            loop {
+                if cursor.node().is_named() {
+                    stack.frames.push(stack.results.len());
+                    if cursor.goto_first_child() {
+                        depth += 1;
+                        continue;
+                    }
+                }
+                loop {
+                    let node = cursor.node();
+                    if node.is_named() {
+                        let start = stack.frames.pop().expect("unbalanced fold stack");
+                        let result = self.fold(&node, stack.results.drain(start..));
+                        stack.results.push(result);
+                    }
+                    if depth == 0 {
+                        return stack.results.pop().expect("unbalanced fold stack");
+                    }
+                    if cursor.goto_next_sibling() {
+                        break;
+                    }
+                    cursor.goto_parent();
+                    depth -= 1;
+                }
+            }
+        }
+    }
+}
+
+/// The reusable stack of `fold_iterative` that goes into the support module.
+pub fn fold_stack() -> proc_macro2::TokenStream {
+    quote::quote! {
+        /// The heap-allocated frames of `fold_iterative`, kept between calls so that folding
+        /// many trees does not allocate once the stack has grown to fit the deepest.
+        pub struct FoldStack<R> {
+            #[doc(hidden)]
+            pub frames: Vec<usize>,
+            #[doc(hidden)]
+            pub results: Vec<R>,
+        }
+
+        impl<R> Default for FoldStack<R> {
+            fn default() -> Self {
+                FoldStack {
+                    frames: Vec::new(),
+                    results: Vec::new(),
+                }
+            }
+        }
+
+        impl<R> FoldStack<R> {
+            pub fn new() -> Self {
+                Self::default()
+            }
+        }
+    }
+}
@@ -0,0 +1,343 @@
+//! Keeps state that a visitor derived from a tree in sync with edits to its text, for sessions
+//! that re-visit a document after every keystroke.
+//!
+//! `apply_edit` edits the tree and hands the same `InputEdit` to the visitor's `on_edit` hook.
+//! The `RangeMap` of the support module stores values by the byte range of the node they were
+//! derived from, and moves them the way `Tree::edit` moves nodes: entries that overlap the edit
+//! are dropped, and those after it are shifted. It is a treap ordered by range, whose nodes carry
+//! the largest end in their subtree and a shift their children still have to be moved by. The
+//! entries after the edit are shifted in O(log n), however many there are. Finding the ones to
+//! drop visits, and rebuilds, every node before the edit whose subtree reaches it. Besides the
+//! dropped entries, that includes any entry that ends before the edit under an ancestor that
+//! spans it.
+
+use proc_macro2::TokenStream;
+use quote::quote;
+use syn::{parse_quote, TraitItem};
+
+pub fn hook() -> TraitItem {
+    parse_quote! {
+        #[doc=r"Called by `apply_edit` after the tree has been edited, to shift or drop whatever"]
+        #[doc=r"the visitor derived from the old text, such as the entries of a `RangeMap`."]
+        #[inline]
+        fn on_edit(&mut self, edit: &::tree_sitter::InputEdit) {}
+    }
+}
+
+pub fn apply_edit() -> TraitItem {
+    parse_quote! {
+        #[doc=r"Edits `tree` like `Tree::edit` and then calls `on_edit`, so that the tree and the"]
+        #[doc=r"state of the visitor describe the same text."]
+        fn apply_edit(&mut self, tree: &mut ::tree_sitter::Tree, edit: &::tree_sitter::InputEdit) {
+            tree.edit(edit);
+            self.on_edit(edit);
+        }
+    }
+}
+
+pub fn range_map() -> TokenStream {
+    quote! {
+        const NO_ENTRY: u32 = u32::MAX;
+
+        struct RangeEntry<V> {
+            start: usize,
+            end: usize,
+            /// The largest `end` in the subtree of this entry.
+            max_end: usize,
+            /// How far the children of this entry still have to be moved.
+            shift: isize,
+            priority: u32,
+            left: u32,
+            right: u32,
+            value: Option<V>,
+        }
+
+        /// Values keyed by the byte range they were derived from, such as the symbols of a scope,
+        /// that follow the edits of a document. Two ranges overlap if they share a byte or touch.
+        pub struct RangeMap<V> {
+            entries: Vec<RangeEntry<V>>,
+            free: Vec<u32>,
+            root: u32,
+            len: usize,
+            seed: u32,
+        }
+
+        impl<V> Default for RangeMap<V> {
+            fn default() -> Self {
+                RangeMap {
+                    entries: Vec::new(),
+                    free: Vec::new(),
+                    root: NO_ENTRY,
+                    len: 0,
+                    seed: 0x9e37_79b9,
+                }
+            }
+        }
+
+        impl<V> RangeMap<V> {
+            pub fn new() -> Self {
+                Self::default()
+            }
+
+            pub fn len(&self) -> usize {
+                self.len
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.len == 0
+            }
+
+            /// Removes all entries, keeping the allocations.
+            pub fn clear(&mut self) {
+                self.entries.clear();
+                self.free.clear();
+                self.root = NO_ENTRY;
+                self.len = 0;
+            }
+
+            /// Stores `value` for `range`, returning the value it replaces.
+            pub fn insert(&mut self, range: ::std::ops::Range<usize>, value: V) -> Option<V> {
+                let (before, rest) = self.split(self.root, (range.start, range.end));
+                let (found, after) = self.split(rest, (range.start, range.end.saturating_add(1)));
+                let (found, old) = if found == NO_ENTRY {
+                    (self.allocate(range, value), None)
+                } else {
+                    (found, self.entries[found as usize].value.replace(value))
+                };
+                let before = self.merge(before, found);
+                self.root = self.merge(before, after);
+                old
+            }
+
+            pub fn remove(&mut self, range: ::std::ops::Range<usize>) -> Option<V> {
+                let (before, rest) = self.split(self.root, (range.start, range.end));
+                let (found, after) = self.split(rest, (range.start, range.end.saturating_add(1)));
+                self.root = self.merge(before, after);
+                if found == NO_ENTRY {
+                    return None;
+                }
+                self.free.push(found);
+                self.len -= 1;
+                self.entries[found as usize].value.take()
+            }
+
+            pub fn get(&self, range: ::std::ops::Range<usize>) -> Option<&V> {
+                let index = self.find(range)?;
+                self.entries[index].value.as_ref()
+            }
+
+            pub fn get_mut(&mut self, range: ::std::ops::Range<usize>) -> Option<&mut V> {
+                let index = self.find(range)?;
+                self.entries[index].value.as_mut()
+            }
+
+            /// Calls `f` with every entry that overlaps `range`, in order of their ranges.
+            pub fn overlapping(
+                &self,
+                range: ::std::ops::Range<usize>,
+                mut f: impl FnMut(::std::ops::Range<usize>, &V),
+            ) {
+                self.overlapping_in(self.root, 0, &range, &mut f);
+            }
+
+            /// Moves the entries like `Tree::edit` moves nodes: those that overlap the edited
+            /// range, including every one that contains it, are removed and handed to
+            /// `invalidated`, and those after it are shifted by the change in length.
+            pub fn edit(
+                &mut self,
+                edit: &::tree_sitter::InputEdit,
+                mut invalidated: impl FnMut(::std::ops::Range<usize>, V),
+            ) {
+                let (before, after) = self.split(self.root, (edit.old_end_byte + 1, 0));
+                let before = self.drain_overlapping(before, edit.start_byte, &mut invalidated);
+                self.shift(after, edit.new_end_byte as isize - edit.old_end_byte as isize);
+                self.root = self.merge(before, after);
+            }
+
+            fn allocate(&mut self, range: ::std::ops::Range<usize>, value: V) -> u32 {
+                // xorshift32, the priorities only have to be spread out.
+                self.seed ^= self.seed << 13;
+                self.seed ^= self.seed >> 17;
+                self.seed ^= self.seed << 5;
+                let entry = RangeEntry {
+                    start: range.start,
+                    end: range.end,
+                    max_end: range.end,
+                    shift: 0,
+                    priority: self.seed,
+                    left: NO_ENTRY,
+                    right: NO_ENTRY,
+                    value: Some(value),
+                };
+                self.len += 1;
+                match self.free.pop() {
+                    Some(index) => {
+                        self.entries[index as usize] = entry;
+                        index
+                    }
+                    None => {
+                        self.entries.push(entry);
+                        (self.entries.len() - 1) as u32
+                    }
+                }
+            }
+
+            fn find(&self, range: ::std::ops::Range<usize>) -> Option<usize> {
+                let mut index = self.root;
+                let mut shift = 0isize;
+                while index != NO_ENTRY {
+                    let entry = &self.entries[index as usize];
+                    let key = (
+                        entry.start.wrapping_add_signed(shift),
+                        entry.end.wrapping_add_signed(shift),
+                    );
+                    shift += entry.shift;
+                    index = match key.cmp(&(range.start, range.end)) {
+                        ::std::cmp::Ordering::Equal => return Some(index as usize),
+                        ::std::cmp::Ordering::Less => entry.right,
+                        ::std::cmp::Ordering::Greater => entry.left,
+                    };
+                }
+                None
+            }
+
+            fn overlapping_in(
+                &self,
+                index: u32,
+                shift: isize,
+                range: &::std::ops::Range<usize>,
+                f: &mut impl FnMut(::std::ops::Range<usize>, &V),
+            ) {
+                if index == NO_ENTRY {
+                    return;
+                }
+                let entry = &self.entries[index as usize];
+                if entry.max_end.wrapping_add_signed(shift) < range.start {
+                    return;
+                }
+                self.overlapping_in(entry.left, shift + entry.shift, range, f);
+                let start = entry.start.wrapping_add_signed(shift);
+                if start > range.end {
+                    return;
+                }
+                let end = entry.end.wrapping_add_signed(shift);
+                if end >= range.start {
+                    if let Some(value) = &entry.value {
+                        f(start..end, value);
+                    }
+                }
+                self.overlapping_in(entry.right, shift + entry.shift, range, f);
+            }
+
+            fn shift(&mut self, index: u32, by: isize) {
+                if index != NO_ENTRY && by != 0 {
+                    let entry = &mut self.entries[index as usize];
+                    entry.start = entry.start.wrapping_add_signed(by);
+                    entry.end = entry.end.wrapping_add_signed(by);
+                    entry.max_end = entry.max_end.wrapping_add_signed(by);
+                    entry.shift += by;
+                }
+            }
+
+            /// Applies the pending shift of an entry to its children.
+            fn push(&mut self, index: u32) {
+                let entry = &mut self.entries[index as usize];
+                let (shift, left, right) = (::std::mem::take(&mut entry.shift), entry.left, entry.right);
+                self.shift(left, shift);
+                self.shift(right, shift);
+            }
+
+            fn update(&mut self, index: u32) {
+                let entry = &self.entries[index as usize];
+                let mut max_end = entry.end;
+                for child in [entry.left, entry.right] {
+                    if child != NO_ENTRY {
+                        max_end = max_end.max(self.entries[child as usize].max_end);
+                    }
+                }
+                self.entries[index as usize].max_end = max_end;
+            }
+
+            /// Splits a subtree into the entries whose `(start, end)` is less than `key` and the rest.
+            fn split(&mut self, index: u32, key: (usize, usize)) -> (u32, u32) {
+                if index == NO_ENTRY {
+                    return (NO_ENTRY, NO_ENTRY);
+                }
+                self.push(index);
+                let entry = &self.entries[index as usize];
+                if (entry.start, entry.end) < key {
+                    let (less, rest) = self.split(entry.right, key);
+                    self.entries[index as usize].right = less;
+                    self.update(index);
+                    (index, rest)
+                } else {
+                    let (less, rest) = self.split(entry.left, key);
+                    self.entries[index as usize].left = rest;
+                    self.update(index);
+                    (less, index)
+                }
+            }
+
+            /// Joins two subtrees whose entries are all less in the first than in the second.
+            fn merge(&mut self, first: u32, second: u32) -> u32 {
+                if first == NO_ENTRY {
+                    return second;
+                }
+                if second == NO_ENTRY {
+                    return first;
+                }
+                if self.entries[first as usize].priority > self.entries[second as usize].priority {
+                    self.push(first);
+                    let right = self.entries[first as usize].right;
+                    self.entries[first as usize].right = self.merge(right, second);
+                    self.update(first);
+                    first
+                } else {
+                    self.push(second);
+                    let left = self.entries[second as usize].left;
+                    self.entries[second as usize].left = self.merge(first, left);
+                    self.update(second);
+                    second
+                }
+            }
+
+            /// Removes the entries of a subtree that end at or after `from`, skipping the subtrees
+            /// that end before it.
+            fn drain_overlapping(
+                &mut self,
+                index: u32,
+                from: usize,
+                invalidated: &mut impl FnMut(::std::ops::Range<usize>, V),
+            ) -> u32 {
+                if index == NO_ENTRY || self.entries[index as usize].max_end < from {
+                    return index;
+                }
+                self.push(index);
+                let (left, right) = {
+                    let entry = &self.entries[index as usize];
+                    (entry.left, entry.right)
+                };
+                // In order, so that `invalidated` sees the entries sorted by range.
+                let left = self.drain_overlapping(left, from, invalidated);
+                let entry = &mut self.entries[index as usize];
+                let removed = entry.end >= from;
+                if removed {
+                    let range = entry.start..entry.end;
+                    let value = entry.value.take().expect("entry without a value");
+                    self.free.push(index);
+                    self.len -= 1;
+                    invalidated(range, value);
+                }
+                let right = self.drain_overlapping(right, from, invalidated);
+                if removed {
+                    return self.merge(left, right);
+                }
+                let entry = &mut self.entries[index as usize];
+                entry.left = left;
+                entry.right = right;
+                self.update(index);
+                index
+            }
+        }
+    }
+}
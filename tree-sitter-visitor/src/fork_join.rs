@@ -0,0 +1,140 @@
+//! Visits the subtrees of one huge tree on all cores, for single files that `visit_parallel`
+//! cannot spread out, such as generated tables and data dumps.
+//!
+//! The tree is split into subtrees: every node that a `ForkJoin` selects is replaced by its named
+//! children, recursively, and what remains is a list of subtrees in document order. Tree-sitter
+//! only lets a tree be used from one thread, so every worker gets its own copy of it, which shares
+//! the nodes and is cheap to make, and splits that copy the same way. Workers claim batches of
+//! consecutive subtrees from a shared counter, so a thread that finishes early takes over work the
+//! others have not started, and each combines the results of its batch. The batches are then
+//! combined in order, which is only the same as a sequential visit when the combiner is
+//! associative.
+
+use proc_macro2::TokenStream;
+use quote::quote;
+use syn::{parse_quote, TraitItem};
+
+pub fn support() -> TokenStream {
+    quote! {
+        /// Which nodes `visit_fork_join` splits into their named children instead of visiting.
+        #[derive(Clone, Copy, Debug, PartialEq, Eq)]
+        pub struct ForkJoin {
+            /// Nodes with at least this many children are split, anonymous children included.
+            pub min_children: usize,
+            /// Nodes that span at least this many bytes are split.
+            pub min_bytes: usize,
+            /// The number of worker threads, one per core by default.
+            pub threads: usize,
+        }
+
+        impl Default for ForkJoin {
+            fn default() -> Self {
+                ForkJoin {
+                    min_children: 1024,
+                    min_bytes: 1 << 20,
+                    threads: ::std::thread::available_parallelism().map_or(1, |n| n.get()),
+                }
+            }
+        }
+
+        impl ForkJoin {
+            #[inline]
+            pub fn splits(&self, node: &::tree_sitter::Node) -> bool {
+                node.child_count() >= self.min_children
+                    || node.end_byte() - node.start_byte() >= self.min_bytes
+            }
+
+            /// The subtrees that `visit_fork_join` visits in place of `node`, in document order.
+            pub fn subtrees<'tree>(
+                &self,
+                node: ::tree_sitter::Node<'tree>,
+            ) -> Vec<::tree_sitter::Node<'tree>> {
+                let mut subtrees = Vec::new();
+                let mut stack = vec![node];
+                let mut cursor = node.walk();
+                while let Some(node) = stack.pop() {
+                    let start = stack.len();
+                    if self.splits(&node) {
+                        stack.extend(node.named_children(&mut cursor));
+                    }
+                    if stack.len() == start {
+                        subtrees.push(node);
+                    } else {
+                        stack[start..].reverse();
+                    }
+                }
+                subtrees
+            }
+        }
+    }
+}
+
+pub fn visit_fork_join(module: &syn::Ident) -> TraitItem {
+    parse_quote! {
+        #[doc=r"Visits `tree` on `split.threads` clones of this visitor, each with its own copy of"]
+        #[doc=r"the tree. Nodes that `split` selects are not visited; they stand for the results of"]
+        #[doc=r"their named children, combined with `combine` in document order. The result is thus"]
+        #[doc=r"that of `visit` on the root if `combine` is associative and the split nodes only"]
+        #[doc=r"combine their children, like the items of a list."]
+        fn visit_fork_join<C>(
+            &self,
+            tree: &::tree_sitter::Tree,
+            split: &#module::ForkJoin,
+            combine: C,
+        ) -> Self::ReturnType
+        where
+            Self: Clone + Send + Sized,
+            Self::ReturnType: Send,
+            C: Fn(Self::ReturnType, Self::ReturnType) -> Self::ReturnType + Sync,
+        {
+            // Every copy splits into the same subtrees, so they can be claimed by index.
+            let count = split.subtrees(tree.root_node()).len();
+            // A few batches per thread keep the threads busy until the end without making the
+            // shared counter contended.
+            let threads = split.threads.clamp(1, count);
+            let batch = (count / (threads * 8)).max(1);
+            let batches = count.div_ceil(batch);
+            let next = ::std::sync::atomic::AtomicUsize::new(0);
+            let mut results: Vec<Option<Self::ReturnType>> = (0..batches).map(|_| None).collect();
+
+            ::std::thread::scope(|scope| {
+                let workers: Vec<_> = (0..threads)
+                    .map(|_| {
+                        let mut visitor = self.clone();
+                        let tree = tree.clone();
+                        let (next, combine) = (&next, &combine);
+                        scope.spawn(move || {
+                            let subtrees = split.subtrees(tree.root_node());
+                            let mut visited = Vec::new();
+                            loop {
+                                let index = next.fetch_add(1, ::std::sync::atomic::Ordering::Relaxed);
+                                if index >= batches {
+                                    break visited;
+                                }
+                                let end = count.min((index + 1) * batch);
+                                let result = subtrees[index * batch..end]
+                                    .iter()
+                                    .map(|node| visitor.visit(node))
+                                    .reduce(combine)
+                                    .expect("empty batch");
+                                visited.push((index, result));
+                            }
+                        })
+                    })
+                    .collect();
+
+                for worker in workers {
+                    for (index, result) in worker.join().expect("visitor thread panicked") {
+                        results[index] = Some(result);
+                    }
+                }
+            });
+
+            results
+                .into_iter()
+                .flatten()
+                .reduce(combine)
+                .expect("fork-join visit without subtrees")
+        }
+    }
+}
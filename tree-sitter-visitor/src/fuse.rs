@@ -0,0 +1,65 @@
+//! Implements the trait for groups of visitors, so that one `walk` drives all of them.
+//!
+//! A pair of visitors is itself a visitor whose hooks call those of both, and pairs nest, so
+//! `(a, (b, c))` walks three passes over a tree at once. The kind of each node is dispatched on
+//! once, by the pair, and a hook that a visitor leaves at its empty default inlines away. Passes
+//! that are only known at runtime can go into a `Vec` of boxed visitors instead.
+
+use proc_macro2::TokenStream;
+use quote::quote;
+
+/// A hook of the trait with the type of its node parameter.
+pub struct Hook {
+    pub name: syn::Ident,
+    pub param: TokenStream,
+}
+
+pub fn fused_impls(trait_name: &syn::Ident, hooks: &[Hook]) -> TokenStream {
+    let pair_hooks = hooks.iter().map(|Hook { name, param }| {
+        quote! {
+            #[inline]
+            fn #name(&mut self, node: #param) {
+                self.0.#name(node);
+                self.1.#name(node);
+            }
+        }
+    });
+    let vec_hooks = hooks.iter().map(|Hook { name, param }| {
+        quote! {
+            #[inline]
+            fn #name(&mut self, node: #param) {
+                for visitor in self.iter_mut() {
+                    visitor.#name(node);
+                }
+            }
+        }
+    });
+
+    // The type parameters are named so as not to shadow a trait called `A` or `V`.
+    quote! {
+        impl<__FuseA: #trait_name, __FuseB: #trait_name> #trait_name for (__FuseA, __FuseB) {
+            type ReturnType = ();
+
+            fn reset(&mut self) {
+                self.0.reset();
+                self.1.reset();
+            }
+
+            #(#pair_hooks)*
+        }
+
+        impl<__FuseV: #trait_name + ?Sized> #trait_name
+            for ::std::vec::Vec<::std::boxed::Box<__FuseV>>
+        {
+            type ReturnType = ();
+
+            fn reset(&mut self) {
+                for visitor in self.iter_mut() {
+                    visitor.reset();
+                }
+            }
+
+            #(#vec_hooks)*
+        }
+    }
+}
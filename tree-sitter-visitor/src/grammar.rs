@@ -0,0 +1,55 @@
+//! Reads hidden choice rules such as `_expr: $ => choice($.add_expr, ...)` out of the
+//! `grammar.json` next to `node-types.json`.
+//!
+//! `node-types.json` only lists the types a field can hold, so this is the only place the name of
+//! the rule behind such a set survives.
+
+use serde_json::Value;
+use std::collections::{BTreeMap, BTreeSet};
+
+/// Maps every hidden rule that is a plain choice between symbols to the visible node types it
+/// can produce.
+pub fn hidden_choices(source: &str) -> BTreeMap<String, BTreeSet<String>> {
+    let grammar: Value = serde_json::from_str(source).expect("could not parse grammar.json");
+    let rules = match grammar.get("rules").and_then(Value::as_object) {
+        Some(rules) => rules,
+        None => return BTreeMap::new(),
+    };
+
+    rules
+        .keys()
+        .filter(|name| name.starts_with('_'))
+        .filter_map(|name| {
+            let mut members = BTreeSet::new();
+            expand(rules, name, &mut members, &mut BTreeSet::new())?;
+            Some((name.clone(), members))
+        })
+        .collect()
+}
+
+fn expand<'a>(
+    rules: &'a serde_json::Map<String, Value>,
+    name: &'a str,
+    members: &mut BTreeSet<String>,
+    seen: &mut BTreeSet<&'a str>,
+) -> Option<()> {
+    if !seen.insert(name) {
+        return Some(());
+    }
+    let rule = rules.get(name)?;
+    if rule.get("type")?.as_str()? != "CHOICE" {
+        return None;
+    }
+    for member in rule.get("members")?.as_array()? {
+        if member.get("type")?.as_str()? != "SYMBOL" {
+            return None;
+        }
+        let symbol = member.get("name")?.as_str()?;
+        if symbol.starts_with('_') {
+            expand(rules, symbol, members, seen)?;
+        } else {
+            members.insert(symbol.to_owned());
+        }
+    }
+    Some(())
+}
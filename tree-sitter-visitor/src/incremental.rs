@@ -0,0 +1,165 @@
+//! Re-visiting an edited document without visiting the parts of it that did not change.
+//!
+//! With `incremental`, `visit(...)` looks every node up in a `VisitCache` owned by the visitor
+//! before dispatching on it. Tree-sitter hands out the same `Node::id()` for subtrees it reused
+//! from the old tree, so results are keyed by id and a node is only visited again when it was not
+//! seen before or overlaps one of the `Tree::changed_ranges` of the edit.
+
+use syn::{parse_quote, TraitItem};
+
+/// The cache type that goes into the support module.
+pub fn cache() -> proc_macro2::TokenStream {
+    quote::quote! {
+        /// Results of `visit` kept from one tree of an edited document to the next, see
+        /// `visit_incremental`.
+        ///
+        /// Node ids are only unique among live trees, so the cache keeps the trees it has entries
+        /// for alive. It lets go of them every now and then, after dropping the entries that are
+        /// not in the newest tree.
+        pub struct VisitCache<R> {
+            entries: ::std::collections::HashMap<usize, R>,
+            changed: Vec<::std::ops::Range<usize>>,
+            trees: Vec<::tree_sitter::Tree>,
+            swept: usize,
+            active: bool,
+        }
+
+        impl<R> Default for VisitCache<R> {
+            fn default() -> Self {
+                VisitCache {
+                    entries: ::std::collections::HashMap::new(),
+                    changed: Vec::new(),
+                    trees: Vec::new(),
+                    swept: 0,
+                    active: false,
+                }
+            }
+        }
+
+        impl<R: Clone> VisitCache<R> {
+            pub fn new() -> Self {
+                Self::default()
+            }
+
+            /// Forgets all results, the next `visit_incremental` visits the whole tree.
+            pub fn clear(&mut self) {
+                self.entries.clear();
+                self.changed.clear();
+                self.trees.clear();
+                self.swept = 0;
+            }
+
+            /// The number of cached results.
+            pub fn len(&self) -> usize {
+                self.entries.len()
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.entries.is_empty()
+            }
+
+            #[doc(hidden)]
+            pub fn begin(
+                &mut self,
+                old_tree: Option<&::tree_sitter::Tree>,
+                new_tree: &::tree_sitter::Tree,
+            ) {
+                match old_tree {
+                    Some(old_tree) if !self.trees.is_empty() => {
+                        self.changed.clear();
+                        self.changed.extend(
+                            old_tree
+                                .changed_ranges(new_tree)
+                                .map(|range| range.start_byte..range.end_byte),
+                        );
+                    }
+                    _ => self.clear(),
+                }
+                self.trees.push(new_tree.clone());
+                self.active = true;
+            }
+
+            #[doc(hidden)]
+            #[inline]
+            pub fn lookup(&self, node: &::tree_sitter::Node) -> Option<R> {
+                if !self.active {
+                    return None;
+                }
+                let (start, end) = (node.start_byte(), node.end_byte());
+                if self
+                    .changed
+                    .iter()
+                    .any(|range| range.start < end && start < range.end)
+                {
+                    return None;
+                }
+                self.entries.get(&node.id()).cloned()
+            }
+
+            #[doc(hidden)]
+            #[inline]
+            pub fn store(&mut self, node: &::tree_sitter::Node, result: &R) {
+                if self.active {
+                    self.entries.insert(node.id(), result.clone());
+                }
+            }
+
+            #[doc(hidden)]
+            pub fn finish(&mut self) {
+                self.active = false;
+                // Entries only ever grow by the nodes that were visited again, so sweeping once
+                // they have doubled keeps the cost of a pass proportional to the size of the edit.
+                if self.trees.len() > 1 && self.entries.len() > 2 * self.swept.max(64) {
+                    let newest = self.trees.pop().expect("no tree was visited");
+                    let mut live = ::std::collections::HashSet::new();
+                    let mut cursor = newest.walk();
+                    'walk: loop {
+                        live.insert(cursor.node().id());
+                        if cursor.goto_first_child() {
+                            continue;
+                        }
+                        while !cursor.goto_next_sibling() {
+                            if !cursor.goto_parent() {
+                                break 'walk;
+                            }
+                        }
+                    }
+                    self.entries.retain(|id, _| live.contains(id));
+                    self.trees.clear();
+                    self.trees.push(newest);
+                    self.swept = self.entries.len();
+                }
+            }
+        }
+    }
+}
+
+/// The accessor a visitor implements to hand out its cache.
+pub fn cache_fn(module: &syn::Ident) -> TraitItem {
+    parse_quote! {
+        #[doc=r"The cache that `visit_incremental` keeps results in between trees."]
+        fn visit_cache(&mut self) -> &mut #module::VisitCache<Self::ReturnType>;
+    }
+}
+
+/// Visits a new tree, reusing the results for the parts it shares with the old one.
+pub fn visit_incremental() -> TraitItem {
+    parse_quote! {
+        #[doc=r"Visits `new_tree`, reusing the cached result of every node that tree-sitter reused"]
+        #[doc=r"from `old_tree` and that is outside of the ranges the edit changed. `old_tree` is"]
+        #[doc=r"the edited tree that `new_tree` was parsed from, `None` visits the whole tree."]
+        #[doc=r""]
+        #[doc=r"Results are only reused through `visit`, and they must not depend on where in the"]
+        #[doc=r"document a node is, since unchanged nodes after an edit can move."]
+        fn visit_incremental(
+            &mut self,
+            old_tree: Option<&::tree_sitter::Tree>,
+            new_tree: &::tree_sitter::Tree,
+        ) -> Self::ReturnType {
+            self.visit_cache().begin(old_tree, new_tree);
+            let result = self.visit(&new_tree.root_node());
+            self.visit_cache().finish();
+            result
+        }
+    }
+}
@@ -2,56 +2,495 @@
 //! language based on `node-types.json` that is part of the generated parser.
 //!
 //! It generates `visit_<node type>()` methods for each node type in the tree-sitter grammar and a generic `visit(...)`
-//! that dispatches to the appropriate typed method. All the trait methods have default implementations that panic, making
-//! it easier to implement visitors for large grammars incrementally.
+//! that dispatches to the appropriate typed method. All the trait methods have default implementations that forward to
+//! `visit_default(...)`, which panics unless it is overridden, making it easier to implement visitors for large grammars
+//! incrementally.
 //!
 //! # Example:
 //!
 //! ```rust
 //! use tree_sitter_visitor::visitor_trait;
-//! 
+//!
 //! #[visitor_trait("../../tree-sitter-tests/src/node-types.json")]
 //! trait CppVisitor { }
 //! ```
 //!
 //! This expands to roughly the following:
 //! ```rust
+//! # mod cpp_visitor { pub fn kind_slot(_: &str) -> Option<usize> { None } }
 //! trait CppVisitor {
 //!     type ReturnType;
 //!
 //!     fn visit(&mut self, node: &tree_sitter::Node) -> Self::ReturnType {
-//!         match node.kind() {
-//!             "node1" => self.visit_node1(node),
-//!             "node2" => self.visit_node2(node),
+//!         self.visit_by_name(node.kind(), node)
+//!     }
+//!
+//!     fn visit_by_name(&mut self, kind: &str, node: &tree_sitter::Node) -> Self::ReturnType {
+//!         match cpp_visitor::kind_slot(kind) {
+//!             Some(0) => self.visit_node1(node),
+//!             Some(1) => self.visit_node2(node),
 //!             /* ... */
-//!             _ => unimplemented!(),
+//!             _ => self.visit_default(node),
 //!         }
 //!     }
 //!
-//!     fn visit_node1(&mut self, node: &tree_sitter::Node) -> Self::ReturnType {
+//!     fn visit_default(&mut self, node: &tree_sitter::Node) -> Self::ReturnType {
 //!          unimplemented!()
 //!     }
 //!
+//!     fn visit_node1(&mut self, node: &tree_sitter::Node) -> Self::ReturnType {
+//!          self.visit_default(node)
+//!     }
+//!
 //!     fn visit_node2(&mut self, node: &tree_sitter::Node) -> Self::ReturnType {
-//!          unimplemented!()
+//!          self.visit_default(node)
 //!     }
 //!     
 //!     /* ... */
+//!
+//!     fn walk(&mut self, cursor: &mut tree_sitter::TreeCursor) {
+//!         /* calls enter(...) and leave(...) for every node under the cursor */
+//!     }
+//!
+//!     fn enter_node1(&mut self, node: &tree_sitter::Node) {}
+//!
+//!     fn leave_node1(&mut self, node: &tree_sitter::Node) {}
+//!
+//!     /* ... */
+//! }
+//! ```
+//!
+//! Node types whose methods would clash with the other methods of the trait, such as the
+//! `"default"` keyword of C-like grammars, get a trailing underscore, as in `visit_default_()`.
+//!
+//! # Node text
+//!
+//! With `source`, the trait takes a lifetime `'src`, or the first one it declares, and requires a
+//! `source(&self) -> &'src [u8]` method returning the text the tree was parsed from. It provides
+//! `bytes(&node)` and `text(&node)` on top of it, which borrow the text of a node from the source
+//! for `'src` instead of copying it, so it can outlive the borrow of the visitor. `text` checks
+//! that the node's text is valid UTF-8; `text_unchecked` skips that outside of debug builds, for
+//! sources known to be valid.
+//!
+//! # Walking a tree
+//!
+//! `visit(...)` leaves it to each method to decide which children to visit. For passes that need to
+//! see every node, `walk(...)` drives a single `TreeCursor` through the subtree in document order
+//! and calls the `enter_<node type>()` hook of each node before its children and
+//! `leave_<node type>()` after them. The hooks default to doing nothing, so only the interesting
+//! ones need to be implemented.
+//!
+//! # Fusing walks
+//!
+//! With `fuse`, the trait is also implemented for pairs of implementors and for a `Vec` of boxed
+//! ones, with hooks that forward to every member, so `(a, (b, c)).walk(&mut cursor)` runs three
+//! passes over a tree in a single walk. Each node is dispatched on once, and in a pair the hooks a
+//! member does not implement inline away. A group has no `visit` or `fold` of its own and cannot
+//! be formed for a trait with required methods, including those of `incremental`, `memoize` and
+//! `source`.
+//!
+//! # Matching queries
+//!
+//! `queries(name = "pattern", ...)` compiles tree-sitter query patterns into Rust matchers in
+//! the support module, after checking every node type, field and child in them against
+//! `node-types.json`. `walk(...)` runs a pattern's matcher in the `enter` arm of each type it can
+//! start with and calls the `on_<name>()` hook with a `<Name>Match` of the captures, so patterns
+//! are found in the same traversal as the other hooks and without a `QueryCursor`.
+//!
+//! ```rust
+//! use tree_sitter_visitor::visitor_trait;
+//!
+//! #[visitor_trait(
+//!     "../../tree-sitter-tests/src/node-types.json",
+//!     kind_id,
+//!     queries(nested_parens = "(paren_expr body: (paren_expr) @inner)"),
+//! )]
+//! trait CalcVisitor { }
+//!
+//! struct RedundantParens(usize);
+//!
+//! impl CalcVisitor for RedundantParens {
+//!     type ReturnType = ();
+//!
+//!     fn on_nested_parens(&mut self, found: calc_visitor::NestedParensMatch) {
+//!         self.0 += 1;
+//!     }
 //! }
 //! ```
+//!
+//! Patterns can use node types, supertypes, wildcards, anonymous nodes, fields and captures.
+//! Children without a field match the first fitting sibling after the previous one, so a pattern
+//! matches a node at most once. Quantifiers, alternations, anchors and predicates are rejected.
+//!
+//! # Skipping subtrees
+//!
+//! Passes that only have hooks for a few node types can walk with `walk_filtered(...)` and a
+//! `KindFilter` from the support module, created from the names of those types. The macro records
+//! from the `fields`, `children` and `subtypes` in `node-types.json` which node types can hold
+//! which directly, `KindFilter::new` works out from that which types can contain the requested
+//! ones, and the walk does not enter the nodes that cannot contain any of them.
+//!
+//! # Folding deep trees
+//!
+//! Visitors that call `visit(...)` on their children use native stack for every level of the
+//! tree. `fold_iterative(...)` instead calls the `fold_<node type>()` method of every named node
+//! with the results of its named children, in post-order, keeping its frames in a reusable
+//! `FoldStack` from the support module. Anonymous nodes have no `fold_` method and are skipped.
+//!
+//! # Async folding
+//!
+//! With `asynchronous`, every named node type also gets an `async fn async_fold_<node type>()`,
+//! which defaults to its `fold_<node type>()`, and `async_fold_iterative(...)` awaits them in the
+//! order `fold_iterative(...)` calls the synchronous ones. Methods that have to wait, on a symbol
+//! server for instance, implement the `async` variant. Since the driver walks the tree on its own
+//! stack rather than through a future per level, a fold of any size is one future whose size does
+//! not depend on the tree, and nothing is boxed per node. These futures are not `Send`, as
+//! `Node` is not, so they run on a single-threaded executor.
+//!
+//! # Lowering into an arena
+//!
+//! Passes that work on their own AST can pass `arena` (together with `kind_id`) to get an `Ast`
+//! in the support module instead. `Ast::build(&node)` lowers a subtree in one `TreeCursor` pass
+//! into contiguous arrays of kind ids, field ids, byte ranges and `u32` parent and subtree
+//! indices, with an `is_<node type>()` check and a `<node type>_<field>()` accessor per field on
+//! top. Only named nodes and tokens in a field are kept.
+//!
+//! `Ast::to_bytes()` writes the arrays into one little-endian buffer, with kind and field ids
+//! narrowed to a byte when the grammar has few enough, and `AstView::new(&bytes)` validates such a
+//! buffer and reads it in place, memory maps included. A view has the same accessors as an `Ast`,
+//! so a cached tree can be analyzed without parsing or copying it.
+//!
+//! # Chunked input
+//!
+//! With `chunked`, the support module can parse input that is not in one `String`. Anything that
+//! is `AsRef<[u8]>`, such as a memory map, implements its `Chunked` trait, and `ChunkedText` reads
+//! a stream into fixed-size pages. `parse_chunked(...)` feeds either to `Parser::parse_with`, and
+//! `Chunked::text(&node)` returns the text of a node, borrowed unless it straddles two pages.
+//!
+//! # Visiting many sources
+//!
+//! `visit_batch(...)` visits a sequence of `(source, tree)` pairs with one visitor, calling its
+//! `reset()` hook between them instead of creating a new visitor for every tree, so whatever
+//! buffers it holds are reused. With `memoize`, each tree is visited through `visit_memoized(...)`
+//! so that its `MemoTable` is reused as well.
+//!
+//! `visit_parallel(...)` parses and visits a slice of sources across all cores. Each worker thread
+//! keeps one `Parser` and one clone of the visitor for all the sources it handles, and a closure
+//! points the visitor at the next source. The results are combined in source order with a
+//! reduce function.
+//!
+//! A single huge file can be spread out with `visit_fork_join(&tree, &split, combine)` instead.
+//! Nodes that the support module's `ForkJoin` selects, by their number of children or their size
+//! in bytes, stand for the results of their named children, and those subtrees are visited by
+//! worker threads that claim batches of them as they go. Each worker reads its own copy of the
+//! tree, as tree-sitter requires. The results are combined in document order, so an associative
+//! `combine` gives the same result as a sequential visit.
+//!
+//! # Dispatching on kind ids
+//!
+//! By default `visit(...)` looks `node.kind()` up in a perfect hash table over the node type names
+//! built by the macro, which costs one hash and one string comparison however many types there
+//! are. The same lookup is available as `visit_by_name(kind, &node)`, for nodes whose type is only
+//! known by name, such as those of a tree read back from elsewhere. Passing `kind_id` reads the
+//! symbol table from the `parser.c` next to `node-types.json` (or from the file given with
+//! `parser = "..."`) and dispatches on `node.kind_id()` instead, which skips the hashing and
+//! compiles down to a single jump table:
+//!
+//! ```rust
+//! use tree_sitter_visitor::visitor_trait;
+//!
+//! #[visitor_trait("../../tree-sitter-tests/src/node-types.json", kind_id)]
+//! trait CppVisitor { }
+//! ```
+//!
+//! # Selecting node types
+//!
+//! `named_only` drops the anonymous node types from the trait, and `only("type", ...)` and
+//! `matching = "regex"` keep just the listed types and those whose whole name matches. The other
+//! types get no methods and share the fallback arm of every dispatcher, so for a large grammar
+//! the trait only grows with the types a pass handles:
+//!
+//! ```rust
+//! use tree_sitter_visitor::visitor_trait;
+//!
+//! #[visitor_trait("../../tree-sitter-tests/src/node-types.json", named_only, matching = ".*_expr")]
+//! trait ExprVisitor { }
+//! ```
+//!
+//! A selection cannot be combined with `typed`, whose wrappers forward to the method of every type.
+//!
+//! # Field accessors
+//!
+//! Next to the trait the macro emits a support module, named after the trait in snake case unless
+//! `module = "..."` is given. It contains a `<node type>_<field>()` accessor for every field in
+//! `node-types.json`, such as `cpp_visitor::add_expr_lhs(&node)`. Fields that can occur more than
+//! once get an accessor that takes a `TreeCursor` and returns an iterator instead.
+//!
+//! With `kind_id` the module also contains the numeric id of every field in `fields`, and the
+//! accessors look children up with `child_by_field_id`, so no field names are compared at runtime.
+//!
+//! Node types whose fields and `children` all hold exactly one named node, or only anonymous
+//! tokens, always have the same number of named children, and `children_of_<node type>()` returns
+//! them as an array, such as `let [lhs, rhs] = cpp_visitor::children_of_add_expr(&node)?`. For
+//! other node types it returns a
+//! `SmallChildren`, which only moves to the heap past `INLINE_CHILDREN` children.
+//!
+//! # Typed nodes
+//!
+//! With `typed`, the support module also contains a `#[repr(transparent)]` wrapper around `Node`
+//! for every named node type (`AddExpr<'tree>` for `add_expr`), with methods for its fields, and
+//! an enum for every supertype and every set of node types a field can hold. The enums are named
+//! after the matching hidden rule in `grammar.json` (`Expr` for `_expr`) where there is one. The
+//! per-type methods of the trait then take these wrappers instead of `&Node`:
+//!
+//! ```rust
+//! use tree_sitter_visitor::visitor_trait;
+//!
+//! #[visitor_trait("../../tree-sitter-tests/src/node-types.json", kind_id, typed)]
+//! trait CalcVisitor { }
+//!
+//! struct Calculator;
+//!
+//! impl CalcVisitor for Calculator {
+//!     type ReturnType = f64;
+//!
+//!     fn visit_add_expr(&mut self, node: calc_visitor::AddExpr) -> f64 {
+//!         node.lhs().unwrap().accept(self) + node.rhs().unwrap().accept(self)
+//!     }
+//! }
+//! # fn main() {}
+//! ```
+//!
+//! `accept` on an enum matches on the variant it holds rather than on the kind of the node, so
+//! it has no fallback for unknown kinds. Wrappers dereference to `Node`, and `cast` converts a
+//! `Node` into a wrapper after checking its kind. Since the wrappers refer back to the trait
+//! through `super::`, a `typed` trait has to be declared at module level rather than in a function.
+//!
+//! # Incremental re-visits
+//!
+//! With `incremental`, `visit(...)` caches the result of every node in the `VisitCache` returned
+//! by the required `visit_cache()` method, and `ReturnType` has to be `Clone`. Given the edited
+//! old tree and the tree parsed from it, `visit_incremental(...)` then only visits the nodes that
+//! tree-sitter did not reuse or that overlap a changed range, so the cost of a re-visit follows
+//! the size of the edit rather than that of the document.
+//!
+//! # Edit-aware state
+//!
+//! With `edits`, the trait gets an `on_edit(...)` hook and `apply_edit(&mut tree, &edit)`, which
+//! edits the tree and then calls the hook, and the support module a `RangeMap`. It stores values
+//! by the byte range of the node they came from. `range_map.edit(&edit, |range, value| ..)` drops
+//! the entries that overlap the edit, handing each to the closure, and shifts those after it in
+//! O(log n). Finding the entries to drop visits every entry whose subtree in the treap reaches
+//! into the edit, which can include entries that end before it.
+//!
+//! # Memoizing
+//!
+//! Analyses that visit the same subtree more than once can pass `memoize` instead. During
+//! `visit_memoized(...)`, `visit(...)` returns a clone of the earlier result for any node it has
+//! seen before in the same tree. Results are kept in the `MemoTable` returned by the required
+//! `memo_table()` method, an open-addressed table keyed by `Node::id()` that is cleared, but not
+//! freed, at the start of every tree.
+//!
+//! # Visit statistics
+//!
+//! When this crate is built with its `stats` feature, `visit(...)` counts its calls per node
+//! kind, and the nanoseconds spent in the `visit_<node type>()` method including the children it
+//! visits, in relaxed atomics indexed by kind id, or by the slot of the name without `kind_id`.
+//! `visit_stats()` in the support module returns a snapshot of the kinds seen. Without the feature
+//! nothing is generated around the dispatch and the snapshot is always empty.
+//!
+//! # Profiling allocations
+//!
+//! The `profile` feature adds a `CountingAllocator` and `profile(...)` to the support module. With
+//! the allocator installed as the global one, `profile(|| ...)` reports the nodes, allocations and
+//! bytes per kind of the visits and walks in the closure, along with nodes per second and the peak
+//! depth, and `Profile::to_json()` writes the report as one line of JSON. Allocations are charged to
+//! the innermost node whose method made them, through a thread local that the dispatchers set.
 #![feature(proc_macro_span)]
 
+mod accessors;
+mod arena;
+mod asynchronous;
+mod cache;
+mod children;
+mod chunked;
+mod dispatch;
+mod drivers;
+mod edits;
+mod fork_join;
+mod fuse;
+mod grammar;
+mod incremental;
+mod memoize;
+mod names;
+mod node_types;
+mod profile;
+mod prune;
+mod query;
+mod select;
+mod stats;
+mod symbols;
+mod text;
+mod typed;
+
+use dispatch::Kinds;
+use names::NameTable;
+use node_types::Node;
 use proc_macro::Span;
 use proc_macro::TokenStream;
+use query::Query;
 use quote::{format_ident, quote, ToTokens};
-use serde::Deserialize;
-use serde_json::from_reader;
-use std::fs::File;
-use syn::{parse_macro_input, parse_quote, AttributeArgs, ItemTrait, Lit, NestedMeta, TraitItem};
-
-#[derive(Deserialize)]
-struct Node {
-    r#type: String,
+use serde_json::from_str;
+use std::collections::{BTreeMap, BTreeSet};
+use symbols::SymbolTable;
+use syn::{
+    parse_macro_input, parse_quote, AttributeArgs, ItemTrait, Lit, Meta, MetaNameValue, NestedMeta,
+    TraitItem,
+};
+use typed::Typed;
+
+/// Options that can follow the path to `node-types.json` in the attribute.
+#[derive(Default)]
+struct Options {
+    /// Dispatch on `Node::kind_id()` instead of `Node::kind()`.
+    kind_id: bool,
+    /// Path to the generated `parser.c`, defaults to the one next to `node-types.json`.
+    parser: Option<String>,
+    /// Name of the support module, defaults to the name of the trait in snake case.
+    module: Option<String>,
+    /// Pass typed wrappers instead of `&Node` to the per-type methods.
+    typed: bool,
+    /// Cache the results of `visit` between the trees of an edited document.
+    incremental: bool,
+    /// Cache the results of `visit` within a tree.
+    memoize: bool,
+    /// Generate an `Ast` that a tree can be lowered into.
+    arena: bool,
+    /// Generate support for parsing input that is not in one contiguous buffer.
+    chunked: bool,
+    /// Require a `source()` method and provide node text helpers on top of it.
+    source: bool,
+    /// Generate `async` fold methods and a driver that awaits them.
+    asynchronous: bool,
+    /// Implement the trait for pairs and vectors of visitors that walk a tree together.
+    fuse: bool,
+    /// Query patterns by name, matched on every node that `walk` enters.
+    queries: Vec<(String, String)>,
+    /// Only generate methods for named node types.
+    named_only: bool,
+    /// Only generate methods for these node types.
+    only: Vec<String>,
+    /// Only generate methods for the node types whose names match this regex.
+    matching: Option<String>,
+    /// Generate an `on_edit` hook and a range-indexed map that follows edits.
+    edits: bool,
+}
+
+impl Options {
+    fn parse(args: impl Iterator<Item = NestedMeta>) -> Options {
+        let mut options = Options::default();
+        for arg in args {
+            match arg {
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("kind_id") => {
+                    options.kind_id = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("typed") => {
+                    options.typed = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("incremental") => {
+                    options.incremental = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("memoize") => {
+                    options.memoize = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("arena") => {
+                    options.arena = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("chunked") => {
+                    options.chunked = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("source") => {
+                    options.source = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("asynchronous") => {
+                    options.asynchronous = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("fuse") => options.fuse = true,
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("edits") => {
+                    options.edits = true
+                }
+                NestedMeta::Meta(Meta::Path(path)) if path.is_ident("named_only") => {
+                    options.named_only = true
+                }
+                NestedMeta::Meta(Meta::List(list)) if list.path.is_ident("only") => {
+                    for name in list.nested {
+                        match name {
+                            NestedMeta::Lit(Lit::Str(s)) => options.only.push(s.value()),
+                            other => panic!(
+                                "expected the name of a node type: {}",
+                                other.into_token_stream()
+                            ),
+                        }
+                    }
+                }
+                NestedMeta::Meta(Meta::List(list)) if list.path.is_ident("queries") => {
+                    for query in list.nested {
+                        match query {
+                            NestedMeta::Meta(Meta::NameValue(MetaNameValue {
+                                path,
+                                lit: Lit::Str(s),
+                                ..
+                            })) if path.get_ident().is_some() => options
+                                .queries
+                                .push((path.get_ident().unwrap().to_string(), s.value())),
+                            other => panic!(
+                                "expected `name = \"pattern\"`: {}",
+                                other.into_token_stream()
+                            ),
+                        }
+                    }
+                }
+                NestedMeta::Meta(Meta::NameValue(MetaNameValue {
+                    path,
+                    lit: Lit::Str(s),
+                    ..
+                })) if path.is_ident("parser") => options.parser = Some(s.value()),
+                NestedMeta::Meta(Meta::NameValue(MetaNameValue {
+                    path,
+                    lit: Lit::Str(s),
+                    ..
+                })) if path.is_ident("module") => options.module = Some(s.value()),
+                NestedMeta::Meta(Meta::NameValue(MetaNameValue {
+                    path,
+                    lit: Lit::Str(s),
+                    ..
+                })) if path.is_ident("matching") => options.matching = Some(s.value()),
+                other => panic!("unknown option: {}", other.into_token_stream()),
+            }
+        }
+        options
+    }
+}
+
+fn snake_case(name: &str) -> String {
+    let mut result = String::with_capacity(name.len() + 4);
+    for (i, c) in name.char_indices() {
+        if c.is_uppercase() && i > 0 {
+            result.push('_');
+        }
+        result.extend(c.to_lowercase());
+    }
+    result
+}
+
+fn camel_case(name: &str) -> String {
+    let mut result = String::with_capacity(name.len());
+    for word in name.split('_').filter(|word| !word.is_empty()) {
+        let mut chars = word.chars();
+        result.extend(chars.next().map(|c| c.to_ascii_uppercase()));
+        result.extend(chars);
+    }
+    result
 }
 
 fn sanitize_identifier(name: &str) -> String {
@@ -110,64 +549,573 @@ fn sanitize_identifier(name: &str) -> String {
     result
 }
 
+/// The strict and reserved keywords of the 2021 edition.
+const KEYWORDS: [&str; 51] = [
+    "as", "break", "const", "continue", "crate", "else", "enum", "extern", "false", "fn", "for",
+    "if", "impl", "in", "let", "loop", "match", "mod", "move", "mut", "pub", "ref", "return",
+    "self", "Self", "static", "struct", "super", "trait", "true", "type", "unsafe", "use", "where",
+    "while", "async", "await", "dyn", "abstract", "become", "box", "do", "final", "macro",
+    "override", "priv", "typeof", "unsized", "virtual", "yield", "try",
+];
+
+/// The identifier for a sanitized name, a raw one like `r#type` if the name is a keyword. The
+/// keywords that cannot be raw identifiers, such as `self`, get a trailing underscore instead.
+fn rust_ident(name: &str) -> syn::Ident {
+    match name {
+        "self" | "Self" | "super" | "crate" | "_" => format_ident!("{}_", name),
+        _ if KEYWORDS.contains(&name) => syn::Ident::new_raw(name, proc_macro2::Span::call_site()),
+        _ => format_ident!("{}", name),
+    }
+}
+
+/// Names that the per-type methods share a prefix with, like `visit_default` or `fold_iterative`.
+const RESERVED_STEMS: [&str; 9] = [
+    "by_name",
+    "default",
+    "batch",
+    "parallel",
+    "fork_join",
+    "incremental",
+    "memoized",
+    "cache",
+    "iterative",
+];
+
+/// The part of the per-type method names after `visit_`, `enter_`, `leave_`, `fold_` and
+/// `async_fold_`. Types whose names would collide with one of the other methods, such as the
+/// `"default"` keyword of many grammars, get a trailing underscore, and so does every type that
+/// only differs from such a name in trailing underscores, to keep the names apart.
+fn method_stem(name: &str) -> String {
+    let mut stem = sanitize_identifier(name);
+    if RESERVED_STEMS.contains(&stem.trim_end_matches('_')) {
+        stem.push('_');
+    }
+    stem
+}
+
 #[proc_macro_attribute]
 pub fn visitor_trait(args: TokenStream, input: TokenStream) -> TokenStream {
     let args = parse_macro_input!(args as AttributeArgs);
     let mut input = parse_macro_input!(input as ItemTrait);
 
-    let path_to_json = match args.into_iter().next() {
+    let mut args = args.into_iter();
+    let path_to_json = match args.next() {
         Some(NestedMeta::Lit(Lit::Str(s))) => s.value(),
         _ => panic!("expected a filename"),
     };
+    let options = Options::parse(args);
 
     let call_site_file = Span::call_site().source_file().path();
     let cwd = call_site_file.parent().unwrap();
     let filename = cwd.join(&path_to_json);
-    let file = File::open(filename).unwrap();
-    let parsed: Vec<Node> = from_reader(file).expect("could not parse the node types JSON");
+    let parsed = cache::load(&filename, |source| {
+        from_str::<Vec<Node>>(source).expect("could not parse the node types JSON")
+    })
+    .expect("could not read the node types JSON");
+
+    // Kind ids are only meaningful for the parser that `node-types.json` was generated alongside,
+    // so they are read from its `parser.c` rather than guessed from the order of node types.
+    let symbols = options.kind_id.then(|| {
+        let parser_path = match &options.parser {
+            Some(path) => cwd.join(path),
+            None => filename.with_file_name("parser.c"),
+        };
+        cache::load(&parser_path, SymbolTable::parse).expect("could not read parser.c")
+    });
+
+    let kinds = Kinds::new(symbols.as_deref());
+    let kind = kinds.subject(quote! { node });
 
-    let (trait_fns, match_arms): (Vec<_>, Vec<_>) = parsed
+    // Items that cannot live in the trait go into a module next to it.
+    let module_name = format_ident!(
+        "{}",
+        options
+            .module
+            .clone()
+            .unwrap_or_else(|| snake_case(&input.ident.to_string()))
+    );
+    let typed = options.typed.then(|| {
+        let rules = cache::load(
+            &filename.with_file_name("grammar.json"),
+            grammar::hidden_choices,
+        )
+        .map(|rules| (*rules).clone())
+        .unwrap_or_default();
+        Typed::new(&parsed, kinds, rules)
+    });
+
+    let mut trait_fns: Vec<TraitItem> = Vec::new();
+    let mut hook_fns: Vec<TraitItem> = Vec::new();
+    let mut visit_arms = Vec::new();
+    let mut enter_arms = Vec::new();
+    let mut leave_arms = Vec::new();
+    let mut fold_arms = Vec::new();
+    let mut name_arms = Vec::new();
+    let mut async_fns: Vec<TraitItem> = Vec::new();
+    let mut async_fold_arms = Vec::new();
+    let mut fused_hooks = Vec::new();
+    // Each query is matched in the `enter` arms of the types its pattern can start with, or
+    // before the dispatch for patterns that start with a wildcard.
+    let queries: Vec<Query> = options
+        .queries
         .iter()
-        .map(|symbol| {
-            let raw_name = &symbol.r#type;
-            let sanitized_name = sanitize_identifier(&symbol.r#type);
-            let method_name = format_ident!("visit_{}", sanitized_name);
-            let doc_name = format!("{:?}", raw_name).replace('`', "\\`");
-            let doc_string = format!("Visits a node of type `{}`", doc_name);
-
-            let trait_fn: TraitItem = parse_quote! {
+        .map(|(name, source)| Query::parse(name.clone(), source.clone()))
+        .collect();
+    let mut query_calls: BTreeMap<String, Vec<proc_macro2::TokenStream>> = BTreeMap::new();
+    let mut wildcard_calls = Vec::new();
+    for query in &queries {
+        let (hook_name, param, hook) = query.hook(&module_name);
+        assert!(
+            !(options.edits && hook_name == "on_edit"),
+            "a query named `edit` clashes with the `on_edit` hook of `edits`"
+        );
+        let fn_name = query.fn_name();
+        let call = quote! {
+            if let Some(found) = #module_name::#fn_name(node) {
+                self.#hook_name(found);
+            }
+        };
+        match query.roots(&parsed) {
+            Some(roots) => {
+                let patterns: BTreeSet<_> = roots
+                    .iter()
+                    .filter_map(|root| kinds.pattern(root))
+                    .map(|pattern| pattern.to_string())
+                    .collect();
+                for pattern in patterns {
+                    query_calls.entry(pattern).or_default().push(call.clone());
+                }
+            }
+            None => wildcard_calls.push(call),
+        }
+        hook_fns.push(hook);
+        if options.fuse {
+            fused_hooks.push(fuse::Hook {
+                name: hook_name,
+                param,
+            });
+        }
+    }
+    let names = NameTable::new(parsed.iter().map(|symbol| symbol.r#type.as_str()));
+    let mut named_slots = vec![false; parsed.len()];
+
+    let selection = select::Selection::new(
+        &parsed,
+        options.named_only,
+        options.only.clone(),
+        options.matching.as_deref(),
+    );
+    // The wrappers of `typed` dispatch to the method of every named type they can hold.
+    assert!(
+        !(options.typed && selection.is_partial()),
+        "`typed` needs the methods of every node type, drop `named_only`, `only` and `matching`"
+    );
+
+    for symbol in parsed.iter() {
+        // Types without methods only keep an arm for the queries that start with them.
+        if !selection.selects(symbol) {
+            let pattern = kinds.pattern(symbol);
+            let calls = pattern
+                .as_ref()
+                .and_then(|pattern| query_calls.get(&pattern.to_string()));
+            if let (Some(pattern), Some(calls)) = (pattern, calls) {
+                enter_arms.push(quote! { #pattern => { #(#calls)* } });
+            }
+            continue;
+        }
+        let raw_name = &symbol.r#type;
+        let sanitized_name = method_stem(&symbol.r#type);
+        let method_name = format_ident!("visit_{}", sanitized_name);
+        let enter_name = format_ident!("enter_{}", sanitized_name);
+        let leave_name = format_ident!("leave_{}", sanitized_name);
+        let fold_name = format_ident!("fold_{}", sanitized_name);
+        let async_fold_name = format_ident!("async_fold_{}", sanitized_name);
+        let doc_name = format!("{:?}", raw_name).replace('`', "\\`");
+        let doc_string = format!("Visits a node of type `{}`", doc_name);
+        let enter_doc = format!(
+            "Called by `walk` before the children of a `{}` node",
+            doc_name
+        );
+        let leave_doc = format!(
+            "Called by `walk` after the children of a `{}` node",
+            doc_name
+        );
+
+        // With `typed`, per-type methods take the wrapper of their node type, which the
+        // dispatchers construct without checking since they just matched on the kind.
+        let wrapper = typed.as_ref().and_then(|typed| typed.wrapper(symbol));
+        let (param, arg) = match &wrapper {
+            Some(wrapper) => (
+                quote! { #module_name::#wrapper<'_> },
+                quote! { #module_name::#wrapper::from_node_unchecked(*node) },
+            ),
+            None => (quote! { &::tree_sitter::Node<'_> }, quote! { node }),
+        };
+
+        // Supertypes are hidden and never dispatched to directly, their wrapper forwards to the
+        // method of whichever subtype it holds.
+        if wrapper.is_some() && symbol.is_supertype() {
+            trait_fns.push(parse_quote! {
                 #[doc=#doc_string]
-                fn #method_name(&mut self, node: &::tree_sitter::Node) -> Self::ReturnType {
-                    unimplemented!(#sanitized_name)
+                fn #method_name(&mut self, node: #param) -> Self::ReturnType {
+                    node.dispatch(self)
                 }
-            };
+            });
+            continue;
+        }
 
-            let match_arm = quote! {
-                #raw_name => self.#method_name(node)
-            };
+        trait_fns.push(parse_quote! {
+            #[doc=#doc_string]
+            fn #method_name(&mut self, node: #param) -> Self::ReturnType {
+                self.visit_default(&*node)
+            }
+        });
+        hook_fns.push(parse_quote! {
+            #[doc=#enter_doc]
+            #[inline]
+            fn #enter_name(&mut self, node: #param) {}
+        });
+        hook_fns.push(parse_quote! {
+            #[doc=#leave_doc]
+            #[inline]
+            fn #leave_name(&mut self, node: #param) {}
+        });
+        if options.fuse {
+            for name in [&enter_name, &leave_name] {
+                fused_hooks.push(fuse::Hook {
+                    name: name.clone(),
+                    param: param.clone(),
+                });
+            }
+        }
+
+        // Anonymous nodes are leaves that `fold_iterative` skips, so they get no `fold_` method.
+        if symbol.named {
+            let fold_doc = format!(
+                "Folds a `{}` node given the results of its named children",
+                doc_name
+            );
+            trait_fns.push(parse_quote! {
+                #[doc=#fold_doc]
+                fn #fold_name(
+                    &mut self,
+                    node: #param,
+                    children: ::std::vec::Drain<'_, Self::ReturnType>,
+                ) -> Self::ReturnType {
+                    self.fold_default(&*node, children)
+                }
+            });
+            if options.asynchronous {
+                async_fns.push(asynchronous::fold_fn(
+                    &async_fold_name,
+                    &fold_name,
+                    &param,
+                    &doc_name,
+                ));
+            }
+        }
 
-            (trait_fn, match_arm)
-        })
-        .unzip();
+        // As in a `match` on the name, the first of two types with the same name wins.
+        let slot = names.slot(raw_name);
+        if !std::mem::replace(&mut named_slots[slot], true) {
+            name_arms.push(quote! { Some(#slot) => self.#method_name(#arg) });
+        }
+
+        let pattern = match kinds.pattern(symbol) {
+            Some(pattern) => pattern,
+            None => continue,
+        };
+        if symbol.named {
+            fold_arms.push(quote! { #pattern => self.#fold_name(#arg, children) });
+            async_fold_arms
+                .push(quote! { #pattern => self.#async_fold_name(#arg, children).await });
+        }
+        visit_arms.push(quote! { #pattern => self.#method_name(#arg) });
+        let calls = query_calls.get(&pattern.to_string()).into_iter().flatten();
+        enter_arms.push(quote! {
+            #pattern => {
+                #(#calls)*
+                self.#enter_name(#arg)
+            }
+        });
+        leave_arms.push(quote! { #pattern => self.#leave_name(#arg) });
+    }
 
-    let return_item: TraitItem = parse_quote! {
-        type ReturnType;
+    // Without kind ids, `visit` goes through the perfect hash rather than comparing the kind
+    // against every name.
+    let dispatch = if kinds.by_id() {
+        quote! {
+            match #kind {
+                #(#visit_arms,)*
+                _ => self.visit_default(node)
+            }
+        }
+    } else {
+        quote! { self.visit_by_name(node.kind(), node) }
+    };
+    // The counters are indexed by kind id or, without kind ids, by the slot of the kind's name.
+    let (stat_index, stat_names) = match symbols.as_deref() {
+        Some(symbols) => {
+            let len = symbols.symbols.iter().map(|s| s.id as usize + 1).max();
+            let mut stat_names = vec![String::new(); len.unwrap_or(0)];
+            for symbol in &symbols.symbols {
+                stat_names[symbol.id as usize] = symbol.name.clone();
+            }
+            (quote! { node.kind_id() as usize }, stat_names)
+        }
+        None => (
+            quote! { #module_name::kind_slot(node.kind()).unwrap_or(usize::MAX) },
+            names.names().to_vec(),
+        ),
     };
-    let dispatch_visit_fn: TraitItem = parse_quote! {
-        #[doc=r"Visits a node of any type."]
-        fn visit(&mut self, node: &::tree_sitter::Node) -> Self::ReturnType {
-            match node.kind() {
-                #(#match_arms,)*
-                _ => panic!("unknown node kind: {}", node.kind())
+    let dispatch = stats::instrument(dispatch, &module_name, stat_index.clone());
+    let dispatch = profile::instrument(dispatch, &module_name, &stat_index);
+    let visit_by_name_fn: TraitItem = parse_quote! {
+        #[doc=r"Visits `node` as a node of the type named `kind`, which need not be its own, looking"]
+        #[doc=r"the name up in a perfect hash table instead of comparing it against every name."]
+        #[doc=r"Types missing from `node-types.json` go to `visit_default`. Results are not cached."]
+        fn visit_by_name(&mut self, kind: &str, node: &::tree_sitter::Node) -> Self::ReturnType {
+            match #module_name::kind_slot(kind) {
+                #(#name_arms,)*
+                _ => self.visit_default(node)
             }
         }
     };
+    // Both caching modes wrap the dispatch in `visit` with a lookup in a table the visitor owns.
+    let caching = match (options.incremental, options.memoize) {
+        (true, true) => panic!("`incremental` already caches every result, drop `memoize`"),
+        (true, false) => Some((
+            format_ident!("visit_cache"),
+            "visit_incremental",
+            [
+                incremental::cache_fn(&module_name),
+                incremental::visit_incremental(),
+            ],
+            incremental::cache(),
+        )),
+        (false, true) => Some((
+            format_ident!("memo_table"),
+            "visit_memoized",
+            [memoize::table_fn(&module_name), memoize::visit_memoized()],
+            memoize::table(),
+        )),
+        (false, false) => None,
+    };
+    let (return_item, dispatch_visit_fn): (TraitItem, TraitItem) = match &caching {
+        Some((table, driver, _, _)) => {
+            let doc = format!(
+                "Visits a node of any type, or returns its cached result during `{}`.",
+                driver
+            );
+            (
+                parse_quote! {
+                    type ReturnType: Clone;
+                },
+                parse_quote! {
+                    #[doc=#doc]
+                    fn visit(&mut self, node: &::tree_sitter::Node) -> Self::ReturnType {
+                        if let Some(result) = self.#table().lookup(node) {
+                            return result;
+                        }
+                        let result = #dispatch;
+                        self.#table().store(node, &result);
+                        result
+                    }
+                },
+            )
+        }
+        None => (
+            parse_quote! {
+                type ReturnType;
+            },
+            parse_quote! {
+                #[doc=r"Visits a node of any type."]
+                fn visit(&mut self, node: &::tree_sitter::Node) -> Self::ReturnType {
+                    #dispatch
+                }
+            },
+        ),
+    };
+    let (caching_fns, cache) = match caching {
+        Some((_, _, fns, support)) => (Some(fns), Some(support)),
+        None => (None, None),
+    };
+    let (enter_dispatch, leave_dispatch) = profile::instrument_walk(
+        quote! {
+            #(#wildcard_calls)*
+            match #kind {
+                #(#enter_arms,)*
+                _ => {}
+            }
+        },
+        quote! {
+            match #kind {
+                #(#leave_arms,)*
+                _ => {}
+            }
+        },
+        &module_name,
+        &stat_index,
+    );
+    let dispatch_enter_fn: TraitItem = parse_quote! {
+        #[doc=r"Dispatches to the `enter_<node type>` hook of a node of any type."]
+        fn enter(&mut self, node: &::tree_sitter::Node) {
+            #enter_dispatch
+        }
+    };
+    let dispatch_leave_fn: TraitItem = parse_quote! {
+        #[doc=r"Dispatches to the `leave_<node type>` hook of a node of any type."]
+        fn leave(&mut self, node: &::tree_sitter::Node) {
+            #leave_dispatch
+        }
+    };
 
-    input.items = [return_item, dispatch_visit_fn]
-        .into_iter()
-        .chain(trait_fns)
-        .chain(input.items)
-        .collect();
+    let dispatch_fold_fn: TraitItem = parse_quote! {
+        #[doc=r"Dispatches to the `fold_<node type>` method of a named node of any type."]
+        fn fold(
+            &mut self,
+            node: &::tree_sitter::Node,
+            children: ::std::vec::Drain<'_, Self::ReturnType>,
+        ) -> Self::ReturnType {
+            match #kind {
+                #(#fold_arms,)*
+                _ => self.fold_default(node, children)
+            }
+        }
+    };
+
+    let reset_fn: TraitItem = parse_quote! {
+        #[doc=r"Called by `visit_batch` before each tree, to clear whatever the visitor collected"]
+        #[doc=r"about the previous one without giving up its allocations."]
+        #[inline]
+        fn reset(&mut self) {}
+    };
+    let source_fns = options
+        .source
+        .then(|| text::source_fns(&text::source_lifetime(&mut input.generics)));
+    let edit_fns = options.edits.then(|| [edits::hook(), edits::apply_edit()]);
+    if options.edits && options.fuse {
+        fused_hooks.push(fuse::Hook {
+            name: format_ident!("on_edit"),
+            param: quote! { &::tree_sitter::InputEdit },
+        });
+    }
+    let async_drivers = options.asynchronous.then(|| {
+        [
+            asynchronous::dispatch_fn(&kind, &async_fold_arms),
+            asynchronous::async_fold_iterative(&module_name),
+        ]
+    });
+    // Every method that is not implemented ends up in one of these, so the dispatchers share a
+    // single out-of-line fallback instead of a panic per arm.
+    let default_fns: [TraitItem; 2] = [
+        parse_quote! {
+            #[doc=r"Called for nodes whose `visit_<node type>` is not implemented, and for nodes"]
+            #[doc=r"of unknown kinds. Panics unless overridden."]
+            #[cold]
+            fn visit_default(&mut self, node: &::tree_sitter::Node) -> Self::ReturnType {
+                unimplemented!("{}", node.kind())
+            }
+        },
+        parse_quote! {
+            #[doc=r"Called for nodes whose `fold_<node type>` is not implemented, and for nodes"]
+            #[doc=r"of unknown kinds. Panics unless overridden."]
+            #[cold]
+            fn fold_default(
+                &mut self,
+                node: &::tree_sitter::Node,
+                children: ::std::vec::Drain<'_, Self::ReturnType>,
+            ) -> Self::ReturnType {
+                unimplemented!("{}", node.kind())
+            }
+        },
+    ];
 
-    TokenStream::from(input.into_token_stream())
+    input.items = [
+        return_item,
+        dispatch_visit_fn,
+        visit_by_name_fn,
+        dispatch_enter_fn,
+        dispatch_leave_fn,
+        dispatch_fold_fn,
+        drivers::walk(),
+        drivers::walk_filtered(&module_name),
+        drivers::fold_iterative(&module_name),
+        drivers::visit_batch(options.memoize),
+        drivers::visit_parallel(),
+        fork_join::visit_fork_join(&module_name),
+    ]
+    .into_iter()
+    .chain(default_fns)
+    .chain(Some(reset_fn))
+    .chain(source_fns.into_iter().flatten())
+    .chain(edit_fns.into_iter().flatten())
+    .chain(async_drivers.into_iter().flatten())
+    .chain(caching_fns.into_iter().flatten())
+    .chain(trait_fns)
+    .chain(hook_fns)
+    .chain(async_fns)
+    .chain(input.items)
+    .collect();
+
+    let vis = &input.vis;
+    let trait_name = &input.ident;
+    let module_doc = format!("Support items generated alongside [`{}`].", input.ident);
+    let field_accessors = accessors::field_accessors(&parsed, symbols.as_deref());
+    let children = children::children_helpers(&parsed);
+    let matchers = queries.iter().map(|query| query.matcher(&parsed, kinds));
+    let fold_stack = drivers::fold_stack();
+    let fork_join = fork_join::support();
+    let kind_filter = prune::kind_filter(&parsed, kinds);
+    let name_table = names.support();
+    let visit_stats = stats::support(&stat_names);
+    let visit_profile = profile::support(&stat_names);
+    let chunked = options.chunked.then(chunked::support);
+    let range_map = options.edits.then(edits::range_map);
+    // The arrays of an `Ast` only hold kind and field ids, so it needs the symbol table.
+    let ast = options.arena.then(|| {
+        let symbols = symbols.as_deref().expect("`arena` needs `kind_id`");
+        arena::ast(&parsed, symbols)
+    });
+    // A group of visitors has nothing to return from `visit` or to cache, only hooks to forward.
+    let fused = options.fuse.then(|| {
+        assert!(
+            !options.incremental && !options.memoize && !options.source,
+            "`fuse` cannot be combined with `incremental`, `memoize` or `source`"
+        );
+        fuse::fused_impls(trait_name, &fused_hooks)
+    });
+    // The wrappers' `accept` methods take the trait's generics, such as the lifetime of `source`.
+    let (_, trait_generics, _) = input.generics.split_for_impl();
+    let trait_params = input.generics.params.iter();
+    let wrappers = typed.map(|typed| {
+        typed.generate(
+            &quote! { <#(#trait_params,)* V: super::#trait_name #trait_generics + ?Sized> },
+        )
+    });
+
+    TokenStream::from(quote! {
+        #input
+
+        #fused
+
+        #[doc=#module_doc]
+        #[allow(dead_code)]
+        #vis mod #module_name {
+            #field_accessors
+            #children
+            #(#matchers)*
+            #fold_stack
+            #fork_join
+            #kind_filter
+            #name_table
+            #visit_stats
+            #visit_profile
+            #ast
+            #chunked
+            #range_map
+            #wrappers
+            #cache
+        }
+    })
 }
@@ -0,0 +1,169 @@
+//! Visiting every node of a tree at most once, however often its parents ask for it.
+//!
+//! With `memoize`, `visit(...)` looks nodes up in a `MemoTable` owned by the visitor while
+//! `visit_memoized` runs. The table is an open-addressed hash table keyed by `Node::id()` that
+//! keeps its slots from one tree to the next.
+
+use syn::{parse_quote, TraitItem};
+
+/// The table type that goes into the support module.
+pub fn table() -> proc_macro2::TokenStream {
+    quote::quote! {
+        /// Results of `visit` for the nodes of the tree that `visit_memoized` is visiting.
+        ///
+        /// Every slot is tagged with the tree it was filled for, so moving on to the next tree
+        /// invalidates all slots at once and an entry is only dropped when its slot is reused.
+        pub struct MemoTable<R> {
+            slots: Vec<(u32, usize, Option<R>)>,
+            len: usize,
+            generation: u32,
+            active: bool,
+        }
+
+        impl<R> Default for MemoTable<R> {
+            fn default() -> Self {
+                MemoTable {
+                    slots: Vec::new(),
+                    len: 0,
+                    generation: 1,
+                    active: false,
+                }
+            }
+        }
+
+        impl<R: Clone> MemoTable<R> {
+            pub fn new() -> Self {
+                Self::default()
+            }
+
+            /// Creates a table that holds `capacity` results before it has to grow.
+            pub fn with_capacity(capacity: usize) -> Self {
+                let mut table = Self::default();
+                table.grow_to((2 * capacity).next_power_of_two());
+                table
+            }
+
+            /// Forgets all results while keeping the slots allocated.
+            pub fn clear(&mut self) {
+                self.len = 0;
+                self.generation = self.generation.wrapping_add(1);
+                if self.generation == 0 {
+                    for slot in &mut self.slots {
+                        *slot = (0, 0, None);
+                    }
+                    self.generation = 1;
+                }
+            }
+
+            /// The number of results for the current tree.
+            pub fn len(&self) -> usize {
+                self.len
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.len == 0
+            }
+
+            #[inline]
+            fn home(&self, id: usize) -> usize {
+                // Node ids are addresses, the multiplication spreads their high bits over the
+                // ones that pick the slot.
+                let hash = (id as u64).wrapping_mul(0x9e37_79b9_7f4a_7c15);
+                (hash >> (64 - self.slots.len().trailing_zeros())) as usize
+            }
+
+            /// The slot that holds `id`, or the empty slot where it would go.
+            #[inline]
+            fn probe(&self, id: usize) -> usize {
+                let mask = self.slots.len() - 1;
+                let mut index = self.home(id);
+                loop {
+                    let (generation, key, _) = &self.slots[index];
+                    if *generation != self.generation || *key == id {
+                        return index;
+                    }
+                    index = (index + 1) & mask;
+                }
+            }
+
+            fn grow_to(&mut self, capacity: usize) {
+                let capacity = capacity.max(16);
+                let old = ::std::mem::replace(
+                    &mut self.slots,
+                    (0..capacity).map(|_| (0, 0, None)).collect(),
+                );
+                for (generation, id, value) in old {
+                    if generation == self.generation {
+                        let index = self.probe(id);
+                        self.slots[index] = (generation, id, value);
+                    }
+                }
+            }
+
+            #[doc(hidden)]
+            pub fn begin(&mut self) {
+                self.clear();
+                self.active = true;
+            }
+
+            #[doc(hidden)]
+            #[inline]
+            pub fn lookup(&self, node: &::tree_sitter::Node) -> Option<R> {
+                if !self.active || self.slots.is_empty() {
+                    return None;
+                }
+                let (generation, _, value) = &self.slots[self.probe(node.id())];
+                if *generation == self.generation {
+                    value.clone()
+                } else {
+                    None
+                }
+            }
+
+            #[doc(hidden)]
+            #[inline]
+            pub fn store(&mut self, node: &::tree_sitter::Node, result: &R) {
+                if !self.active {
+                    return;
+                }
+                // Keeping at least half of the slots free bounds the length of probe sequences.
+                if 2 * (self.len + 1) > self.slots.len() {
+                    self.grow_to(2 * self.slots.len());
+                }
+                let index = self.probe(node.id());
+                if self.slots[index].0 != self.generation {
+                    self.len += 1;
+                }
+                self.slots[index] = (self.generation, node.id(), Some(result.clone()));
+            }
+
+            #[doc(hidden)]
+            pub fn finish(&mut self) {
+                self.active = false;
+            }
+        }
+    }
+}
+
+/// The accessor a visitor implements to hand out its table.
+pub fn table_fn(module: &syn::Ident) -> TraitItem {
+    parse_quote! {
+        #[doc=r"The table that `visit_memoized` keeps the results of the current tree in."]
+        fn memo_table(&mut self) -> &mut #module::MemoTable<Self::ReturnType>;
+    }
+}
+
+/// Visits a tree, calling the per-type method of every node at most once.
+pub fn visit_memoized() -> TraitItem {
+    parse_quote! {
+        #[doc=r"Visits `tree` with every `visit(...)` of a node that was visited before returning"]
+        #[doc=r"a clone of the earlier result. The table is cleared first, not shrunk, so visiting"]
+        #[doc=r"many trees in a row does not allocate once it has grown to fit the largest."]
+        fn visit_memoized(&mut self, tree: &::tree_sitter::Tree) -> Self::ReturnType {
+            self.memo_table().begin();
+            let result = self.visit(&tree.root_node());
+            self.memo_table().finish();
+            result
+        }
+    }
+}
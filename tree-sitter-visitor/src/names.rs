@@ -0,0 +1,153 @@
+//! A perfect hash over the node type names, for dispatching on a kind string in constant time.
+//!
+//! A `match` on strings compares the subject against one arm after the other. Instead, the names
+//! are placed into a table with one slot per name by hash and displace: every name hashes to a
+//! bucket, and each bucket gets a pair of displacements, searched for here, that moves its names
+//! into slots no other name uses. Looking a name up is then one hash, one table read and a single
+//! string comparison, and the slot it yields can be matched on like a kind id.
+
+use proc_macro2::TokenStream;
+use quote::quote;
+
+/// Names per bucket. Larger buckets make the table smaller but the displacements harder to find.
+const BUCKET_SIZE: usize = 4;
+
+/// The hash of a name, which `support` emits again for the lookup at runtime.
+fn hash(seed: u64, name: &str) -> u64 {
+    let mut hash = 0xcbf2_9ce4_8422_2325 ^ seed;
+    for &byte in name.as_bytes() {
+        hash ^= byte as u64;
+        hash = hash.wrapping_mul(0x0000_0100_0000_01b3);
+    }
+    hash
+}
+
+/// Splits a hash into its bucket and the two values that are displaced into a slot.
+fn split(hash: u64) -> (u32, u32, u32) {
+    let mixed = (hash ^ (hash >> 31)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+    ((hash >> 32) as u32, hash as u32, (mixed >> 32) as u32)
+}
+
+fn slot(f1: u32, f2: u32, (d1, d2): (u32, u32), len: usize) -> usize {
+    (f2.wrapping_add(f1.wrapping_mul(d1)).wrapping_add(d2) as usize) % len
+}
+
+pub struct NameTable {
+    seed: u64,
+    displacements: Vec<(u32, u32)>,
+    /// The name in every slot.
+    names: Vec<String>,
+}
+
+impl NameTable {
+    /// Builds a table over the distinct names among `names`.
+    pub fn new<'a>(names: impl IntoIterator<Item = &'a str>) -> Self {
+        let mut unique: Vec<&str> = Vec::new();
+        for name in names {
+            if !unique.contains(&name) {
+                unique.push(name);
+            }
+        }
+        (0..)
+            .find_map(|seed| Self::try_seed(seed, &unique))
+            .expect("no perfect hash for the node type names")
+    }
+
+    fn try_seed(seed: u64, names: &[&str]) -> Option<Self> {
+        let len = names.len().max(1);
+        let bucket_count = names.len().div_ceil(BUCKET_SIZE).max(1);
+        let hashes: Vec<_> = names.iter().map(|name| split(hash(seed, name))).collect();
+        let mut buckets = vec![Vec::new(); bucket_count];
+        for (i, &(g, _, _)) in hashes.iter().enumerate() {
+            buckets[g as usize % bucket_count].push(i);
+        }
+        // The fullest buckets are the hardest to place, so they go first while slots are free.
+        let mut order: Vec<usize> = (0..buckets.len()).collect();
+        order.sort_by_key(|&bucket| std::cmp::Reverse(buckets[bucket].len()));
+
+        let mut taken = vec![None; len];
+        let mut displacements = vec![(0, 0); buckets.len()];
+        let mut candidate = Vec::with_capacity(BUCKET_SIZE);
+        for bucket in order
+            .into_iter()
+            .filter(|&bucket| !buckets[bucket].is_empty())
+        {
+            let found = (0..len as u32)
+                .flat_map(|d1| (0..len as u32).map(move |d2| (d1, d2)))
+                .find(|&pair| {
+                    candidate.clear();
+                    buckets[bucket].iter().all(|&i| {
+                        let (_, f1, f2) = hashes[i];
+                        let slot = slot(f1, f2, pair, len);
+                        let free = taken[slot].is_none() && !candidate.contains(&slot);
+                        candidate.push(slot);
+                        free
+                    })
+                })?;
+            displacements[bucket] = found;
+            for (&i, &slot) in buckets[bucket].iter().zip(&candidate) {
+                taken[slot] = Some(i);
+            }
+        }
+
+        let names = taken
+            .into_iter()
+            .map(|i| i.map_or_else(String::new, |i| names[i].to_owned()))
+            .collect();
+        Some(NameTable {
+            seed,
+            displacements,
+            names,
+        })
+    }
+
+    /// The slot that `kind_slot` returns for `name`, which must be one of the names in the table.
+    pub fn slot(&self, name: &str) -> usize {
+        let (g, f1, f2) = split(hash(self.seed, name));
+        let pair = self.displacements[g as usize % self.displacements.len()];
+        let slot = slot(f1, f2, pair, self.names.len());
+        assert_eq!(self.names[slot], name, "name missing from the perfect hash");
+        slot
+    }
+
+    /// The name in every slot, empty for unused slots.
+    pub fn names(&self) -> &[String] {
+        &self.names
+    }
+
+    /// The table and its `kind_slot` lookup, for the support module.
+    pub fn support(&self) -> TokenStream {
+        let seed = self.seed;
+        let names = &self.names;
+        let len = self.names.len();
+        let bucket_count = self.displacements.len();
+        let displacements = self
+            .displacements
+            .iter()
+            .map(|(d1, d2)| quote! { (#d1, #d2) });
+
+        quote! {
+            const SLOT_NAMES: [&str; #len] = [#(#names),*];
+            const SLOT_DISPLACEMENTS: [(u32, u32); #bucket_count] = [#(#displacements),*];
+
+            /// Looks up the node type with the given name in a perfect hash table, returning its
+            /// slot, or `None` if `node-types.json` has no type with that name. A named and an
+            /// anonymous type with the same name share a slot.
+            #[inline]
+            // Grammars with a handful of names have a single bucket.
+            #[allow(clippy::modulo_one)]
+            pub fn kind_slot(kind: &str) -> Option<usize> {
+                let mut hash: u64 = 0xcbf2_9ce4_8422_2325 ^ #seed;
+                for &byte in kind.as_bytes() {
+                    hash ^= byte as u64;
+                    hash = hash.wrapping_mul(0x0000_0100_0000_01b3);
+                }
+                let mixed = (hash ^ (hash >> 31)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+                let (g, f1, f2) = ((hash >> 32) as u32, hash as u32, (mixed >> 32) as u32);
+                let (d1, d2) = SLOT_DISPLACEMENTS[g as usize % #bucket_count];
+                let slot = (f2.wrapping_add(f1.wrapping_mul(d1)).wrapping_add(d2) as usize) % #len;
+                (SLOT_NAMES[slot] == kind).then(|| slot)
+            }
+        }
+    }
+}
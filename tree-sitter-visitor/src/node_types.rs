@@ -0,0 +1,38 @@
+//! The subset of `node-types.json` that the generated code is derived from.
+
+use serde::Deserialize;
+use std::collections::BTreeMap;
+
+#[derive(Deserialize)]
+pub struct Node {
+    pub r#type: String,
+    pub named: bool,
+    #[serde(default)]
+    pub fields: BTreeMap<String, Field>,
+    #[serde(default)]
+    pub children: Option<Field>,
+    #[serde(default)]
+    pub subtypes: Vec<TypeRef>,
+}
+
+impl Node {
+    /// Supertypes never appear in a tree, they only group other node types.
+    pub fn is_supertype(&self) -> bool {
+        !self.subtypes.is_empty()
+    }
+}
+
+#[derive(Deserialize)]
+pub struct Field {
+    pub multiple: bool,
+    #[serde(default)]
+    pub required: bool,
+    #[serde(default)]
+    pub types: Vec<TypeRef>,
+}
+
+#[derive(Deserialize, Clone, PartialEq, Eq, PartialOrd, Ord)]
+pub struct TypeRef {
+    pub r#type: String,
+    pub named: bool,
+}
@@ -0,0 +1,295 @@
+//! Charges the allocations made while visiting to the kind of the node being visited, when this
+//! crate is built with its `profile` feature.
+//!
+//! The support module then contains a `CountingAllocator` for the binary to install as its global
+//! allocator, and `profile(...)`, which runs a closure and reports the nodes, allocations and bytes
+//! per kind, the throughput and the peak depth of `visit` and `walk`, as JSON if wanted. The kind a
+//! node is charged for lives in a thread local that `visit`, `enter` and `leave` set around
+//! their dispatch, so allocations are charged to the innermost node whose method made them.
+//! Without the feature none of this is generated.
+
+use proc_macro2::TokenStream;
+use quote::quote;
+
+pub fn enabled() -> bool {
+    cfg!(feature = "profile")
+}
+
+/// Charges what the dispatch of `visit` does to the kind at `index`, counting one node one level
+/// deeper than the caller.
+pub fn instrument(dispatch: TokenStream, module: &syn::Ident, index: &TokenStream) -> TokenStream {
+    if !enabled() {
+        return dispatch;
+    }
+    quote! {{
+        let outer = #module::profile_enter(#index);
+        let result = #dispatch;
+        #module::profile_leave(outer);
+        result
+    }}
+}
+
+/// Like `instrument`, for `enter` and `leave`, between which `walk` visits the children. The
+/// node stays counted in the depth until its `leave`.
+pub fn instrument_walk(
+    enter: TokenStream,
+    leave: TokenStream,
+    module: &syn::Ident,
+    index: &TokenStream,
+) -> (TokenStream, TokenStream) {
+    if !enabled() {
+        return (enter, leave);
+    }
+    (
+        quote! {
+            let outer = #module::profile_enter(#index);
+            #enter
+            #module::profile_pause(outer);
+        },
+        quote! {
+            let outer = #module::profile_resume(#index);
+            #leave
+            #module::profile_leave(outer);
+        },
+    )
+}
+
+/// The counters, the allocator and `profile(...)`, given the name of the kind behind every index.
+pub fn support(names: &[String]) -> Option<TokenStream> {
+    if !enabled() {
+        return None;
+    }
+    let len = names.len();
+    Some(quote! {
+        const PROFILE_NAMES: [&str; #len] = [#(#names),*];
+        const PROFILE_ZERO: ::std::sync::atomic::AtomicU64 = ::std::sync::atomic::AtomicU64::new(0);
+        // One counter per kind, and one more for allocations outside of any node.
+        static PROFILE_NODES: [::std::sync::atomic::AtomicU64; #len] = [PROFILE_ZERO; #len];
+        static PROFILE_ALLOCATIONS: [::std::sync::atomic::AtomicU64; #len + 1] =
+            [PROFILE_ZERO; #len + 1];
+        static PROFILE_BYTES: [::std::sync::atomic::AtomicU64; #len + 1] = [PROFILE_ZERO; #len + 1];
+
+        struct ProfileState {
+            on: ::std::cell::Cell<bool>,
+            kind: ::std::cell::Cell<usize>,
+            depth: ::std::cell::Cell<usize>,
+            peak: ::std::cell::Cell<usize>,
+        }
+
+        // Initialized without allocating and without a destructor, so the allocator can read it.
+        thread_local! {
+            static PROFILE: ProfileState = const {
+                ProfileState {
+                    on: ::std::cell::Cell::new(false),
+                    kind: ::std::cell::Cell::new(#len),
+                    depth: ::std::cell::Cell::new(0),
+                    peak: ::std::cell::Cell::new(0),
+                }
+            };
+        }
+
+        #[doc(hidden)]
+        #[inline]
+        pub fn profile_enter(index: usize) -> usize {
+            PROFILE.with(|state| {
+                if !state.on.get() {
+                    return state.kind.get();
+                }
+                if let Some(nodes) = PROFILE_NODES.get(index) {
+                    nodes.fetch_add(1, ::std::sync::atomic::Ordering::Relaxed);
+                }
+                let depth = state.depth.get() + 1;
+                state.depth.set(depth);
+                state.peak.set(state.peak.get().max(depth));
+                state.kind.replace(index.min(#len))
+            })
+        }
+
+        #[doc(hidden)]
+        #[inline]
+        pub fn profile_pause(outer: usize) {
+            PROFILE.with(|state| state.kind.set(outer));
+        }
+
+        #[doc(hidden)]
+        #[inline]
+        pub fn profile_resume(index: usize) -> usize {
+            PROFILE.with(|state| state.kind.replace(index.min(#len)))
+        }
+
+        #[doc(hidden)]
+        #[inline]
+        pub fn profile_leave(outer: usize) {
+            PROFILE.with(|state| {
+                if state.on.get() {
+                    state.depth.set(state.depth.get().saturating_sub(1));
+                }
+                state.kind.set(outer);
+            });
+        }
+
+        fn count_allocation(size: usize) {
+            let _ = PROFILE.try_with(|state| {
+                if state.on.get() {
+                    let kind = state.kind.get();
+                    PROFILE_ALLOCATIONS[kind].fetch_add(1, ::std::sync::atomic::Ordering::Relaxed);
+                    PROFILE_BYTES[kind].fetch_add(size as u64, ::std::sync::atomic::Ordering::Relaxed);
+                }
+            });
+        }
+
+        /// A global allocator that counts the allocations of the thread running `profile(...)`,
+        /// by the kind of the node being visited, and forwards everything to the allocator it
+        /// wraps. Install it with `#[global_allocator]`.
+        pub struct CountingAllocator<A = ::std::alloc::System>(pub A);
+
+        unsafe impl<A: ::std::alloc::GlobalAlloc> ::std::alloc::GlobalAlloc for CountingAllocator<A> {
+            unsafe fn alloc(&self, layout: ::std::alloc::Layout) -> *mut u8 {
+                count_allocation(layout.size());
+                self.0.alloc(layout)
+            }
+
+            unsafe fn alloc_zeroed(&self, layout: ::std::alloc::Layout) -> *mut u8 {
+                count_allocation(layout.size());
+                self.0.alloc_zeroed(layout)
+            }
+
+            unsafe fn realloc(
+                &self,
+                ptr: *mut u8,
+                layout: ::std::alloc::Layout,
+                new_size: usize,
+            ) -> *mut u8 {
+                count_allocation(new_size);
+                self.0.realloc(ptr, layout, new_size)
+            }
+
+            unsafe fn dealloc(&self, ptr: *mut u8, layout: ::std::alloc::Layout) {
+                self.0.dealloc(ptr, layout)
+            }
+        }
+
+        /// What `profile(...)` counted for one node kind. Allocations are charged to the
+        /// innermost node whose method made them, not to its ancestors.
+        #[derive(Clone, Copy, PartialEq, Eq, Debug)]
+        pub struct KindProfile {
+            pub kind: &'static str,
+            pub nodes: u64,
+            pub allocations: u64,
+            pub bytes: u64,
+        }
+
+        /// The report of one `profile(...)` run. The totals include the allocations made
+        /// outside of any node.
+        #[derive(Clone, PartialEq, Debug)]
+        pub struct Profile {
+            pub kinds: Vec<KindProfile>,
+            pub nodes: u64,
+            pub allocations: u64,
+            pub bytes: u64,
+            pub nanos: u64,
+            pub peak_depth: usize,
+        }
+
+        impl Profile {
+            pub fn nodes_per_second(&self) -> f64 {
+                self.nodes as f64 * 1e9 / self.nanos.max(1) as f64
+            }
+
+            /// The report as one line of JSON, for tracking it over time.
+            pub fn to_json(&self) -> String {
+                use ::std::fmt::Write;
+
+                let mut json = format!(
+                    "{{\"nodes\":{},\"allocations\":{},\"bytes\":{},\"nanos\":{},\
+                     \"nodes_per_second\":{:.1},\"peak_depth\":{},\"kinds\":[",
+                    self.nodes,
+                    self.allocations,
+                    self.bytes,
+                    self.nanos,
+                    self.nodes_per_second(),
+                    self.peak_depth
+                );
+                for (i, kind) in self.kinds.iter().enumerate() {
+                    let separator = if i == 0 { "" } else { "," };
+                    json.push_str(separator);
+                    json.push_str("{\"kind\":\"");
+                    for c in kind.kind.chars() {
+                        match c {
+                            '"' | '\\' => {
+                                json.push('\\');
+                                json.push(c);
+                            }
+                            c if c.is_control() => {
+                                let _ = write!(json, "\\u{:04x}", c as u32);
+                            }
+                            c => json.push(c),
+                        }
+                    }
+                    let _ = write!(
+                        json,
+                        "\",\"nodes\":{},\"allocations\":{},\"bytes\":{}}}",
+                        kind.nodes,
+                        kind.allocations,
+                        kind.bytes
+                    );
+                }
+                json.push_str("]}");
+                json
+            }
+        }
+
+        /// Runs `run` on this thread and reports what its visits did. Allocations are only
+        /// counted if `CountingAllocator` is the global allocator, and only one thread should
+        /// profile at a time, since the counters are shared.
+        pub fn profile<R>(run: impl FnOnce() -> R) -> (R, Profile) {
+            let load = |counter: &::std::sync::atomic::AtomicU64| {
+                counter.load(::std::sync::atomic::Ordering::Relaxed)
+            };
+            for counter in PROFILE_NODES.iter().chain(&PROFILE_ALLOCATIONS).chain(&PROFILE_BYTES) {
+                counter.store(0, ::std::sync::atomic::Ordering::Relaxed);
+            }
+            // Turns counting off again and restores the kind of the caller, also when `run`
+            // panics, so that the thread can profile again afterwards.
+            struct Session(usize);
+            impl Drop for Session {
+                fn drop(&mut self) {
+                    PROFILE.with(|state| {
+                        state.on.set(false);
+                        state.kind.set(self.0);
+                    });
+                }
+            }
+            let session = PROFILE.with(|state| {
+                assert!(!state.on.replace(true), "`profile` cannot be nested");
+                state.depth.set(0);
+                state.peak.set(0);
+                Session(state.kind.get())
+            });
+            let start = ::std::time::Instant::now();
+            let result = run();
+            let nanos = start.elapsed().as_nanos() as u64;
+            let peak_depth = PROFILE.with(|state| state.peak.get());
+            drop(session);
+
+            let kinds: Vec<KindProfile> = (0..#len)
+                .map(|i| KindProfile {
+                    kind: PROFILE_NAMES[i],
+                    nodes: load(&PROFILE_NODES[i]),
+                    allocations: load(&PROFILE_ALLOCATIONS[i]),
+                    bytes: load(&PROFILE_BYTES[i]),
+                })
+                .filter(|kind| kind.nodes > 0 || kind.allocations > 0)
+                .collect();
+            let profile = Profile {
+                nodes: kinds.iter().map(|kind| kind.nodes).sum(),
+                allocations: PROFILE_ALLOCATIONS.iter().map(load).sum(),
+                bytes: PROFILE_BYTES.iter().map(load).sum(),
+                kinds,
+                nanos,
+                peak_depth,
+            };
+            (result, profile)
+        }
+    })
+}
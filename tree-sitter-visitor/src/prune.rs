@@ -0,0 +1,145 @@
+//! Works out which subtrees a walk has to enter to reach the node types a pass is interested in.
+//!
+//! `node-types.json` lists the types every field and `children` can hold and the subtypes of
+//! every supertype. The macro only turns those edges around into the types that can hold each
+//! type directly; `KindFilter::new` follows them up from the types it is given, at runtime and only
+//! for those, to find every type that can contain one of them.
+
+use crate::dispatch::Kinds;
+use crate::node_types::{Node, TypeRef};
+use proc_macro2::TokenStream;
+use quote::quote;
+use std::collections::{BTreeMap, BTreeSet};
+
+pub fn kind_filter(nodes: &[Node], kinds: Kinds) -> TokenStream {
+    let index: BTreeMap<(&str, bool), usize> = nodes
+        .iter()
+        .enumerate()
+        .map(|(i, node)| ((node.r#type.as_str(), node.named), i))
+        .collect();
+    let lookup = |type_ref: &TypeRef| {
+        index
+            .get(&(type_ref.r#type.as_str(), type_ref.named))
+            .copied()
+    };
+
+    let edges: Vec<Vec<usize>> = nodes
+        .iter()
+        .map(|node| {
+            let fields = node.fields.values().chain(&node.children);
+            fields
+                .flat_map(|field| &field.types)
+                .chain(&node.subtypes)
+                .filter_map(lookup)
+                .collect()
+        })
+        .collect();
+
+    // Types that nothing can contain are the root and the extras, like comments, which can
+    // appear anywhere. Looking for one of those means nothing can be skipped.
+    let mut contained = vec![false; nodes.len()];
+    for &child in edges.iter().flatten() {
+        contained[child] = true;
+    }
+
+    // Nodes are told apart by the same pattern `visit` matches on, and in name mode a named and
+    // an anonymous type can share one, so the filter works on groups of types with equal patterns.
+    let mut groups: Vec<TokenStream> = Vec::new();
+    let mut group_by_pattern = BTreeMap::new();
+    let mut group_of = vec![None; nodes.len()];
+    for (i, node) in nodes.iter().enumerate() {
+        let pattern = match kinds.pattern(node) {
+            Some(pattern) => pattern,
+            None => continue,
+        };
+        let group = *group_by_pattern
+            .entry(pattern.to_string())
+            .or_insert_with(|| {
+                groups.push(pattern);
+                groups.len() - 1
+            });
+        group_of[i] = Some(group);
+    }
+
+    // For every type, the types that can hold it directly.
+    let mut parents = vec![BTreeSet::new(); nodes.len()];
+    for (parent, children) in edges.iter().enumerate() {
+        for &child in children {
+            parents[child].insert(parent as u16);
+        }
+    }
+
+    let names = nodes.iter().map(|node| &node.r#type);
+    let anywhere = contained.iter().map(|contained| !contained);
+    let parents = parents.iter().map(|parents| quote! { &[#(#parents),*] });
+    let group_of = group_of
+        .iter()
+        .map(|group| group.map_or(u16::MAX, |group| group as u16));
+    let group_count = groups.len();
+    let arms = groups.iter().enumerate().map(|(group, pattern)| {
+        quote! { #pattern => Some(#group) }
+    });
+    let kind = kinds.subject(quote! { node });
+
+    quote! {
+        const NODE_TYPES: &[&str] = &[#(#names),*];
+        const ANYWHERE: &[bool] = &[#(#anywhere),*];
+        const PARENTS: &[&[u16]] = &[#(#parents),*];
+        /// The group that `may_contain` puts each type in, `u16::MAX` for none.
+        const GROUP_OF: &[u16] = &[#(#group_of),*];
+
+        /// The node types that `walk_filtered` is looking for, and with them the subtrees that it
+        /// has to enter to find them.
+        #[derive(Clone, Debug)]
+        pub struct KindFilter {
+            descend: Vec<bool>,
+            everywhere: bool,
+        }
+
+        impl KindFilter {
+            /// Creates a filter for the node types with the given names.
+            ///
+            /// Panics if `node-types.json` has no type with one of the names.
+            pub fn new(node_types: &[&str]) -> Self {
+                let mut filter = KindFilter {
+                    descend: vec![false; #group_count],
+                    everywhere: false,
+                };
+                // Every type above one of the wanted ones has to be entered.
+                let mut seen = vec![false; NODE_TYPES.len()];
+                let mut stack = Vec::new();
+                for name in node_types {
+                    let mut found = false;
+                    for (i, _) in NODE_TYPES.iter().enumerate().filter(|(_, n)| *n == name) {
+                        found = true;
+                        filter.everywhere |= ANYWHERE[i];
+                        stack.extend_from_slice(PARENTS[i]);
+                    }
+                    assert!(found, "unknown node type: {}", name);
+                }
+                while let Some(parent) = stack.pop() {
+                    let parent = parent as usize;
+                    if ::std::mem::replace(&mut seen[parent], true) {
+                        continue;
+                    }
+                    if GROUP_OF[parent] != u16::MAX {
+                        filter.descend[GROUP_OF[parent] as usize] = true;
+                    }
+                    stack.extend_from_slice(PARENTS[parent]);
+                }
+                filter
+            }
+
+            /// Whether one of the node types can occur below `node`. Errors and kinds missing
+            /// from `node-types.json` can hold anything, so they are always entered.
+            #[inline]
+            pub fn may_contain(&self, node: &::tree_sitter::Node) -> bool {
+                let group: Option<usize> = match #kind {
+                    #(#arms,)*
+                    _ => None,
+                };
+                self.everywhere || group.map_or(true, |group| self.descend[group])
+            }
+        }
+    }
+}
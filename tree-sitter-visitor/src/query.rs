@@ -0,0 +1,516 @@
+//! Compiles the tree-sitter query patterns given with `queries(...)` into matchers that `walk`
+//! runs on the nodes it enters, so a pass finds its patterns in the same traversal as its hooks
+//! instead of in a separate `QueryCursor` pass.
+//!
+//! Patterns are checked against `node-types.json` while expanding: every node type has to exist,
+//! every field has to belong to the type it is used on, or for a wildcard to some type, and every
+//! child has to be one of the types that place can hold. The supported subset is nodes `(type ...)`, wildcards `(_)` and
+//! `_`, anonymous nodes `"+"`, fields `field: pattern`, and captures `@name`. Supertypes match
+//! any of their subtypes. Quantifiers, alternations, anchors and predicates are rejected.
+//!
+//! Children without a field are matched in order, each against the first sibling after the
+//! previous match that fits it, so unlike a `QueryCursor` a pattern matches a node at most once.
+
+use crate::accessors::{child_lookup, children_lookup};
+use crate::dispatch::Kinds;
+use crate::node_types::{Node, TypeRef};
+use crate::{camel_case, rust_ident, sanitize_identifier};
+use proc_macro2::TokenStream;
+use quote::{format_ident, quote};
+use std::collections::{BTreeMap, BTreeSet};
+
+enum Kind {
+    Named(String),
+    Anonymous(String),
+    /// `(_)`, any named node.
+    AnyNamed,
+    /// `_`, any node.
+    Any,
+}
+
+struct Pattern {
+    kind: Kind,
+    fields: Vec<(String, Pattern)>,
+    children: Vec<Pattern>,
+    capture: Option<String>,
+}
+
+pub struct Query {
+    pub name: String,
+    source: String,
+    pattern: Pattern,
+}
+
+struct Parser<'a> {
+    query: &'a str,
+    rest: &'a str,
+}
+
+impl<'a> Parser<'a> {
+    fn fail(&self, message: &str) -> ! {
+        panic!("query `{}`: {}", self.query, message)
+    }
+
+    fn skip_space(&mut self) {
+        loop {
+            self.rest = self.rest.trim_start();
+            match self.rest.strip_prefix(';') {
+                Some(comment) => self.rest = comment.split_once('\n').map_or("", |(_, rest)| rest),
+                None => return,
+            }
+        }
+    }
+
+    fn eat(&mut self, token: char) -> bool {
+        self.skip_space();
+        match self.rest.strip_prefix(token) {
+            Some(rest) => {
+                self.rest = rest;
+                true
+            }
+            None => false,
+        }
+    }
+
+    fn identifier(&mut self) -> Option<&'a str> {
+        self.skip_space();
+        let end = self
+            .rest
+            .find(|c: char| !(c.is_alphanumeric() || c == '_' || c == '-' || c == '.'))
+            .unwrap_or(self.rest.len());
+        let (identifier, rest) = self.rest.split_at(end);
+        (!identifier.is_empty()).then(|| {
+            self.rest = rest;
+            identifier
+        })
+    }
+
+    fn string(&mut self) -> String {
+        let mut result = String::new();
+        let mut chars = self.rest.char_indices();
+        while let Some((i, c)) = chars.next() {
+            match c {
+                '"' => {
+                    self.rest = &self.rest[i + 1..];
+                    return result;
+                }
+                '\\' => match chars.next() {
+                    Some((_, 'n')) => result.push('\n'),
+                    Some((_, 't')) => result.push('\t'),
+                    Some((_, 'r')) => result.push('\r'),
+                    Some((_, c)) => result.push(c),
+                    None => break,
+                },
+                c => result.push(c),
+            }
+        }
+        self.fail("unterminated string")
+    }
+
+    fn pattern(&mut self) -> Pattern {
+        self.skip_space();
+        let kind = if self.eat('(') {
+            match self.identifier() {
+                Some("_") => Kind::AnyNamed,
+                Some(name) => Kind::Named(name.to_string()),
+                None => self.fail("expected a node type after `(`"),
+            }
+        } else if self.eat('"') {
+            Kind::Anonymous(self.string())
+        } else if self.identifier() == Some("_") {
+            Kind::Any
+        } else {
+            self.unsupported()
+        };
+        let mut pattern = Pattern {
+            kind,
+            fields: Vec::new(),
+            children: Vec::new(),
+            capture: None,
+        };
+
+        if matches!(pattern.kind, Kind::Named(_) | Kind::AnyNamed) {
+            while !self.eat(')') {
+                let before = self.rest;
+                match self.identifier() {
+                    Some(field) if self.eat(':') => {
+                        let child = self.pattern();
+                        pattern.fields.push((field.to_string(), child));
+                    }
+                    _ => {
+                        self.rest = before;
+                        pattern.children.push(self.pattern());
+                    }
+                }
+            }
+        }
+        if self.eat('@') {
+            match self.identifier() {
+                Some(capture) => pattern.capture = Some(capture.to_string()),
+                None => self.fail("expected a capture name after `@`"),
+            }
+        }
+        pattern
+    }
+
+    fn unsupported(&self) -> ! {
+        match self.rest.chars().next() {
+            Some(c) => self.fail(&format!("`{}` is not supported in queries", c)),
+            None => self.fail("unexpected end of the pattern"),
+        }
+    }
+}
+
+impl Query {
+    pub fn parse(name: String, source: String) -> Query {
+        let mut parser = Parser {
+            query: &name,
+            rest: &source,
+        };
+        let pattern = parser.pattern();
+        parser.skip_space();
+        if !parser.rest.is_empty() {
+            parser.unsupported();
+        }
+        Query {
+            pattern,
+            name,
+            source,
+        }
+    }
+
+    fn hook_name(&self) -> syn::Ident {
+        format_ident!("on_{}", sanitize_identifier(&self.name))
+    }
+
+    pub fn fn_name(&self) -> syn::Ident {
+        format_ident!("match_{}", sanitize_identifier(&self.name))
+    }
+
+    fn struct_name(&self) -> syn::Ident {
+        format_ident!("{}Match", camel_case(&sanitize_identifier(&self.name)))
+    }
+
+    fn captures(&self) -> Vec<syn::Ident> {
+        let mut captures = Vec::new();
+        let mut stack = vec![&self.pattern];
+        while let Some(pattern) = stack.pop() {
+            if let Some(capture) = &pattern.capture {
+                let ident = capture_ident(capture);
+                if ident == "node" {
+                    panic!(
+                        "query `{}`: `@node` is reserved for the matched node",
+                        self.name
+                    );
+                }
+                if captures.contains(&ident) {
+                    panic!(
+                        "query `{}`: capture `@{}` is used twice",
+                        self.name, capture
+                    );
+                }
+                captures.push(ident);
+            }
+            stack.extend(pattern.fields.iter().map(|(_, child)| child).rev());
+            stack.extend(pattern.children.iter().rev());
+        }
+        captures
+    }
+
+    /// The trait hook that `enter` calls on a match.
+    pub fn hook(&self, module: &syn::Ident) -> (syn::Ident, TokenStream, syn::TraitItem) {
+        let hook_name = self.hook_name();
+        let struct_name = self.struct_name();
+        let param = quote! { #module::#struct_name<'_> };
+        let doc = format!(
+            "Called by `walk` on every node that matches `{}`, before its `enter_` hook",
+            self.source.replace('`', "\\`")
+        );
+        let item = syn::parse_quote! {
+            #[doc=#doc]
+            #[inline]
+            fn #hook_name(&mut self, found: #param) {}
+        };
+        (hook_name, param, item)
+    }
+
+    /// The node types the root of the pattern can have, `None` for a wildcard.
+    pub fn roots<'n>(&self, nodes: &'n [Node]) -> Option<Vec<&'n Node>> {
+        let types = Types::new(nodes);
+        types.of(&self.name, &self.pattern.kind)
+    }
+
+    /// Checks the pattern against `node-types.json` and generates its match struct and matcher.
+    pub fn matcher(&self, nodes: &[Node], kinds: Kinds) -> TokenStream {
+        let types = Types::new(nodes);
+        types.check(&self.name, &self.pattern, None);
+
+        let struct_name = self.struct_name();
+        let fn_name = self.fn_name();
+        let captures = self.captures();
+        let mut helpers = Vec::new();
+        let root = self.helper(&self.pattern, &types, kinds, &mut helpers);
+
+        let struct_doc = format!("A match of `{}`", self.source.replace('`', "\\`"));
+        let fn_doc = format!(
+            "Matches `{}` against the given node, not its descendants",
+            self.source.replace('`', "\\`")
+        );
+        quote! {
+            #[doc=#struct_doc]
+            #[derive(Clone, Copy, Debug)]
+            pub struct #struct_name<'tree> {
+                /// The node the pattern matched.
+                pub node: ::tree_sitter::Node<'tree>,
+                #(pub #captures: ::tree_sitter::Node<'tree>,)*
+            }
+
+            #[doc=#fn_doc]
+            pub fn #fn_name<'tree>(
+                node: &::tree_sitter::Node<'tree>,
+            ) -> Option<#struct_name<'tree>> {
+                // `node` is not a capture, so the marker cannot clash with one.
+                #[derive(Default)]
+                struct Found<'tree> {
+                    #(#captures: Option<::tree_sitter::Node<'tree>>,)*
+                    node: ::std::marker::PhantomData<::tree_sitter::Node<'tree>>,
+                }
+
+                #(#helpers)*
+
+                let mut found = Found::default();
+                if !#root(*node, &mut found) {
+                    return None;
+                }
+                Some(#struct_name {
+                    node: *node,
+                    #(#captures: found.#captures?,)*
+                })
+            }
+        }
+    }
+
+    /// Generates a function that matches one node of the pattern and records its captures.
+    fn helper(
+        &self,
+        pattern: &Pattern,
+        types: &Types,
+        kinds: Kinds,
+        helpers: &mut Vec<TokenStream>,
+    ) -> syn::Ident {
+        let index = helpers.len();
+        let name = format_ident!("pattern_{}", index);
+        helpers.push(TokenStream::new());
+
+        let own = types.of(&self.name, &pattern.kind);
+        let test = match &own {
+            Some(own) => kinds.test(quote! { node }, own),
+            None if matches!(pattern.kind, Kind::AnyNamed) => quote! { node.is_named() },
+            None => quote! { true },
+        };
+        let fields = pattern.fields.iter().map(|(field_name, child)| {
+            let child_fn = self.helper(child, types, kinds, helpers);
+            // Without a known type, any field of the name may hold more than one node.
+            let multiple = match &own {
+                Some(own) => own
+                    .iter()
+                    .filter_map(|node| node.fields.get(field_name))
+                    .any(|field| field.multiple),
+                None => true,
+            };
+            if multiple {
+                let lookup = children_lookup(kinds.by_id(), quote! { node }, field_name);
+                quote! {
+                    let cursor = &mut node.walk();
+                    let mut children = #lookup;
+                    if !children.any(|child| #child_fn(child, found)) {
+                        return false;
+                    }
+                }
+            } else {
+                let lookup = child_lookup(kinds.by_id(), quote! { node }, field_name);
+                quote! {
+                    match #lookup {
+                        Some(child) if #child_fn(child, found) => {}
+                        _ => return false,
+                    }
+                }
+            }
+        });
+        let fields: Vec<_> = fields.collect();
+        let children: Vec<_> = pattern
+            .children
+            .iter()
+            .map(|child| self.helper(child, types, kinds, helpers))
+            .collect();
+        let next = (!children.is_empty()).then(|| quote! { let mut next = 0; });
+        let capture = pattern.capture.as_ref().map(|capture| {
+            let ident = capture_ident(capture);
+            quote! { found.#ident = Some(node); }
+        });
+
+        helpers[index] = quote! {
+            fn #name<'tree>(node: ::tree_sitter::Node<'tree>, found: &mut Found<'tree>) -> bool {
+                if !(#test) {
+                    return false;
+                }
+                #(#fields)*
+                #next
+                #(
+                    loop {
+                        match node.child(next) {
+                            Some(child) => {
+                                next += 1;
+                                if #children(child, found) {
+                                    break;
+                                }
+                            }
+                            None => return false,
+                        }
+                    }
+                )*
+                #capture
+                true
+            }
+        };
+        name
+    }
+}
+
+/// The field of the match struct for a capture, `@name.definition` becomes `name_definition`
+/// and `@type` becomes `r#type`.
+fn capture_ident(capture: &str) -> syn::Ident {
+    rust_ident(&sanitize_identifier(&capture.replace(['.', '-'], "_")).to_lowercase())
+}
+
+/// The node types of `node-types.json` by name, with supertypes expanded into their subtypes.
+struct Types<'n> {
+    nodes: BTreeMap<(&'n str, bool), &'n Node>,
+    /// Types that no field or `children` lists: extras like comments, which can appear anywhere,
+    /// and the root, which `node-types.json` does not tell apart from them.
+    extras: BTreeSet<(&'n str, bool)>,
+}
+
+impl<'n> Types<'n> {
+    fn new(nodes: &'n [Node]) -> Self {
+        let contained: BTreeSet<_> = nodes
+            .iter()
+            .flat_map(|node| node.fields.values().chain(&node.children))
+            .flat_map(|field| &field.types)
+            .chain(nodes.iter().flat_map(|node| &node.subtypes))
+            .map(|type_ref| (type_ref.r#type.as_str(), type_ref.named))
+            .collect();
+        Types {
+            nodes: nodes
+                .iter()
+                .map(|node| ((node.r#type.as_str(), node.named), node))
+                .collect(),
+            extras: nodes
+                .iter()
+                .map(|node| (node.r#type.as_str(), node.named))
+                .filter(|key| !contained.contains(key))
+                .collect(),
+        }
+    }
+
+    /// The types a node matching `kind` can have, `None` for wildcards.
+    fn of(&self, query: &str, kind: &Kind) -> Option<Vec<&'n Node>> {
+        let (name, named) = match kind {
+            Kind::Named(name) => (name.as_str(), true),
+            Kind::Anonymous(name) => (name.as_str(), false),
+            Kind::AnyNamed | Kind::Any => return None,
+        };
+        match self.nodes.get(&(name, named)) {
+            Some(node) => Some(self.expand(std::slice::from_ref(&TypeRef {
+                r#type: node.r#type.clone(),
+                named,
+            }))),
+            None if named => panic!("query `{}`: unknown node type `{}`", query, name),
+            None => panic!("query `{}`: unknown anonymous node `{:?}`", query, name),
+        }
+    }
+
+    /// The concrete types behind a list of types that may contain supertypes.
+    fn expand(&self, type_refs: &[TypeRef]) -> Vec<&'n Node> {
+        let mut result: Vec<&Node> = Vec::new();
+        let mut stack: Vec<&TypeRef> = type_refs.iter().rev().collect();
+        while let Some(type_ref) = stack.pop() {
+            let node = match self.nodes.get(&(type_ref.r#type.as_str(), type_ref.named)) {
+                Some(node) => *node,
+                None => continue,
+            };
+            if node.is_supertype() {
+                stack.extend(node.subtypes.iter().rev());
+            } else if !result.iter().any(|seen| std::ptr::eq(*seen, node)) {
+                result.push(node);
+            }
+        }
+        result
+    }
+
+    /// Panics unless every part of `pattern` can occur, inside a place that holds `allowed`.
+    fn check(&self, query: &str, pattern: &Pattern, allowed: Option<&[&Node]>) {
+        let own = self.of(query, &pattern.kind);
+        if let (Some(own), Some(allowed)) = (&own, allowed) {
+            let fits = own.iter().any(|node| {
+                allowed.iter().any(|other| std::ptr::eq(*node, *other))
+                    || self.extras.contains(&(node.r#type.as_str(), node.named))
+            });
+            if !fits {
+                let name = match &pattern.kind {
+                    Kind::Named(name) | Kind::Anonymous(name) => name,
+                    _ => unreachable!(),
+                };
+                panic!("query `{}`: `{}` cannot occur there", query, name);
+            }
+        }
+
+        // A wildcard can be any type that has the field.
+        let candidates: Vec<&Node> = match &own {
+            Some(own) => own.clone(),
+            None => self.nodes.values().copied().collect(),
+        };
+        for (field_name, child) in &pattern.fields {
+            let fields: Vec<_> = candidates
+                .iter()
+                .filter_map(|node| node.fields.get(field_name))
+                .collect();
+            if fields.is_empty() {
+                let owner = match &own {
+                    Some(own) => own
+                        .iter()
+                        .map(|node| node.r#type.as_str())
+                        .collect::<Vec<_>>()
+                        .join("`, `"),
+                    None => "_".to_owned(),
+                };
+                panic!(
+                    "query `{}`: `{}` has no field `{}`",
+                    query, owner, field_name
+                );
+            }
+            let type_refs: Vec<TypeRef> = fields
+                .iter()
+                .flat_map(|field| field.types.iter().cloned())
+                .collect();
+            self.check(query, child, Some(&self.expand(&type_refs)));
+        }
+
+        // Anonymous children are not listed in `node-types.json`, only the named ones are checked.
+        let any_child = own.as_ref().map(|own| {
+            let type_refs: Vec<TypeRef> = own
+                .iter()
+                .flat_map(|node| node.fields.values().chain(&node.children))
+                .flat_map(|field| field.types.iter().cloned())
+                .collect();
+            self.expand(&type_refs)
+        });
+        for child in &pattern.children {
+            let allowed = match child.kind {
+                Kind::Anonymous(_) => None,
+                _ => any_child.as_deref(),
+            };
+            self.check(query, child, allowed);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+//! Decides which node types get methods in the trait, for grammars too large to generate all of.
+//!
+//! Without `named_only`, `only(...)` or `matching = "..."` every type in `node-types.json` is
+//! selected. Types that are not get no `visit_`, `enter_`, `leave_` or `fold_` method and no arm
+//! of their own: `visit` and `fold` send them to their `_default` method and the hooks do nothing,
+//! so the dispatchers only have arms for the types a pass uses.
+
+use crate::node_types::Node;
+use regex::Regex;
+
+pub struct Selection {
+    named_only: bool,
+    only: Vec<String>,
+    matching: Option<Regex>,
+}
+
+impl Selection {
+    /// Panics if `only` names a type that `node-types.json` does not have, or if `matching` is
+    /// not a valid regex.
+    pub fn new(
+        nodes: &[Node],
+        named_only: bool,
+        only: Vec<String>,
+        matching: Option<&str>,
+    ) -> Selection {
+        for name in &only {
+            if !nodes.iter().any(|node| &node.r#type == name) {
+                panic!("`only` names an unknown node type: {:?}", name);
+            }
+        }
+        // The pattern has to match the whole name, as in a `match` on it.
+        let matching = matching.map(|pattern| {
+            Regex::new(&format!("^(?:{})$", pattern))
+                .unwrap_or_else(|error| panic!("invalid `matching` regex: {}", error))
+        });
+        Selection {
+            named_only,
+            only,
+            matching,
+        }
+    }
+
+    pub fn is_partial(&self) -> bool {
+        self.named_only || !self.only.is_empty() || self.matching.is_some()
+    }
+
+    /// Whether the type gets methods: it has to be named under `named_only`, and be listed in
+    /// `only` or match `matching` when either is given.
+    pub fn selects(&self, node: &Node) -> bool {
+        if self.named_only && !node.named {
+            return false;
+        }
+        if self.only.is_empty() && self.matching.is_none() {
+            return true;
+        }
+        self.only.contains(&node.r#type)
+            || self
+                .matching
+                .as_ref()
+                .is_some_and(|regex| regex.is_match(&node.r#type))
+    }
+}
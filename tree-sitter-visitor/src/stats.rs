@@ -0,0 +1,101 @@
+//! Counts the calls to `visit` per node kind, and the time spent in them, when this crate is built
+//! with its `stats` feature.
+//!
+//! The decision is made while expanding the macro, so without the feature `visit` is generated
+//! exactly as before and `visit_stats()` always returns an empty snapshot.
+
+use proc_macro2::TokenStream;
+use quote::quote;
+
+pub fn enabled() -> bool {
+    cfg!(feature = "stats")
+}
+
+/// Wraps the dispatch of `visit` in a measurement for the counter at `index`, an expression of
+/// type `usize` from which out of range values are not recorded.
+pub fn instrument(dispatch: TokenStream, module: &syn::Ident, index: TokenStream) -> TokenStream {
+    if !enabled() {
+        return dispatch;
+    }
+    quote! {{
+        let start = ::std::time::Instant::now();
+        let result = #dispatch;
+        #module::record_visit(#index, start);
+        result
+    }}
+}
+
+/// The counters and `visit_stats()`, given the name of the kind behind every counter index.
+pub fn support(names: &[String]) -> TokenStream {
+    let len = names.len();
+    let counters = enabled().then(|| {
+        quote! {
+            const STAT_NAMES: [&str; #len] = [#(#names),*];
+            const STAT_ZERO: ::std::sync::atomic::AtomicU64 = ::std::sync::atomic::AtomicU64::new(0);
+            static STAT_CALLS: [::std::sync::atomic::AtomicU64; #len] = [STAT_ZERO; #len];
+            static STAT_NANOS: [::std::sync::atomic::AtomicU64; #len] = [STAT_ZERO; #len];
+
+            #[doc(hidden)]
+            #[inline]
+            pub fn record_visit(index: usize, start: ::std::time::Instant) {
+                let nanos = start.elapsed().as_nanos() as u64;
+                if let (Some(calls), Some(total)) = (STAT_CALLS.get(index), STAT_NANOS.get(index)) {
+                    calls.fetch_add(1, ::std::sync::atomic::Ordering::Relaxed);
+                    total.fetch_add(nanos, ::std::sync::atomic::Ordering::Relaxed);
+                }
+            }
+        }
+    });
+    let snapshot = if enabled() {
+        quote! {
+            let load = |counter: &::std::sync::atomic::AtomicU64| {
+                counter.load(::std::sync::atomic::Ordering::Relaxed)
+            };
+            STAT_NAMES
+                .iter()
+                .zip(STAT_CALLS.iter().zip(&STAT_NANOS))
+                .filter(|(_, (calls, _))| load(calls) > 0)
+                .map(|(&kind, (calls, nanos))| KindStats {
+                    kind,
+                    calls: load(calls),
+                    nanos: load(nanos),
+                })
+                .collect()
+        }
+    } else {
+        quote! { Vec::new() }
+    };
+    let reset = enabled().then(|| {
+        quote! {
+            for counter in STAT_CALLS.iter().chain(&STAT_NANOS) {
+                counter.store(0, ::std::sync::atomic::Ordering::Relaxed);
+            }
+        }
+    });
+
+    quote! {
+        #counters
+
+        /// How often `visit` dispatched on one node kind, and for how long.
+        #[derive(Clone, Copy, PartialEq, Eq, Debug)]
+        pub struct KindStats {
+            pub kind: &'static str,
+            pub calls: u64,
+            /// The time spent in the `visit_<node type>` method, including the children it
+            /// visited.
+            pub nanos: u64,
+        }
+
+        /// The kinds `visit` has dispatched on since the start of the process or the last
+        /// `reset_visit_stats()`, across all threads and visitors of the trait. Always empty
+        /// unless `tree-sitter-visitor` is built with its `stats` feature.
+        pub fn visit_stats() -> Vec<KindStats> {
+            #snapshot
+        }
+
+        /// Sets all counters of `visit_stats()` back to zero.
+        pub fn reset_visit_stats() {
+            #reset
+        }
+    }
+}
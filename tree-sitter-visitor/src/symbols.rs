@@ -0,0 +1,178 @@
+//! Reads the symbol and field tables out of the `parser.c` that `tree-sitter generate` emits next
+//! to `node-types.json`.
+//!
+//! The numeric ids in these tables are the ones the runtime hands out through `Node::kind_id()`
+//! and `TreeCursor::field_id()`, so knowing them at expansion time lets the generated code
+//! dispatch on integers instead of comparing strings.
+
+use std::collections::HashMap;
+
+pub struct Symbol {
+    pub id: u16,
+    pub name: String,
+    pub named: bool,
+    pub public: bool,
+}
+
+pub struct SymbolTable {
+    pub symbols: Vec<Symbol>,
+    pub fields: Vec<(u16, String)>,
+}
+
+impl SymbolTable {
+    pub fn parse(source: &str) -> SymbolTable {
+        let mut constants = HashMap::new();
+        constants.insert("ts_builtin_sym_end".to_owned(), 0u16);
+        for body in enum_bodies(source) {
+            for line in body.lines() {
+                let line = line.trim().trim_end_matches(',');
+                if let Some((name, value)) = line.split_once(" = ") {
+                    if let Ok(value) = value.trim().parse() {
+                        constants.insert(name.trim().to_owned(), value);
+                    }
+                }
+            }
+        }
+        let resolve = |name: &str| -> u16 {
+            name.parse()
+                .ok()
+                .or_else(|| constants.get(name).copied())
+                .unwrap_or_else(|| panic!("unknown symbol `{}` in parser.c", name))
+        };
+
+        let names: Vec<(u16, String)> = table_entries(source, "ts_symbol_names")
+            .expect("parser.c does not contain a symbol name table")
+            .into_iter()
+            .map(|(index, value)| (resolve(&index), c_string(&value)))
+            .collect();
+
+        // Older parsers have no symbol map, in which case every symbol is public.
+        let public_map: HashMap<u16, u16> = table_entries(source, "ts_symbol_map")
+            .unwrap_or_default()
+            .into_iter()
+            .map(|(index, value)| (resolve(&index), resolve(&value)))
+            .collect();
+
+        let named: HashMap<u16, bool> = table_entries(source, "ts_symbol_metadata")
+            .expect("parser.c does not contain a symbol metadata table")
+            .into_iter()
+            .map(|(index, value)| (resolve(&index), value.contains(".named = true")))
+            .collect();
+
+        let symbols = names
+            .into_iter()
+            .map(|(id, name)| Symbol {
+                id,
+                name,
+                named: named.get(&id).copied().unwrap_or(false),
+                public: !matches!(public_map.get(&id), Some(&public) if public != id),
+            })
+            .collect();
+
+        let fields = table_entries(source, "ts_field_names")
+            .unwrap_or_default()
+            .into_iter()
+            .filter(|(_, value)| value != "NULL")
+            .map(|(index, value)| (resolve(&index), c_string(&value)))
+            .collect();
+
+        SymbolTable { symbols, fields }
+    }
+
+    /// Returns all ids that `Node::kind_id()` can report for a node type from `node-types.json`.
+    pub fn kind_ids(&self, name: &str, named: bool) -> Vec<u16> {
+        self.symbols
+            .iter()
+            .filter(|s| s.public && s.named == named && s.name == name)
+            .map(|s| s.id)
+            .collect()
+    }
+}
+
+fn enum_bodies(source: &str) -> impl Iterator<Item = &str> {
+    // Newer generators name the enums (`enum ts_symbol_identifiers {`), older ones do not.
+    source
+        .split("\nenum ")
+        .skip(1)
+        .filter_map(|rest| rest.split_once('{'))
+        .filter_map(|(_, rest)| rest.split_once("\n};"))
+        .map(|(body, _)| body)
+}
+
+/// Splits the body of a designated-initializer array (`[index] = value,`) into its entries.
+fn table_entries(source: &str, table: &str) -> Option<Vec<(String, String)>> {
+    let start = source.find(&format!(" {}[", table))?;
+    let body = &source[start..];
+    let body = &body[body.find("= {")? + 3..];
+    let body = &body[..body.find("\n};")?];
+
+    let mut entries = Vec::new();
+    let mut rest = body.trim_start();
+    while let Some(stripped) = rest.strip_prefix('[') {
+        let close = stripped.find(']')?;
+        let index = stripped[..close].trim().to_owned();
+        let after = stripped[close + 1..]
+            .trim_start()
+            .strip_prefix('=')?
+            .trim_start();
+        let end = value_end(after);
+        entries.push((index, after[..end].trim().to_owned()));
+        rest = after[end..]
+            .trim_start()
+            .trim_start_matches(',')
+            .trim_start();
+    }
+    Some(entries)
+}
+
+/// Finds where a single initializer value ends, skipping over string literals and braces.
+fn value_end(value: &str) -> usize {
+    let mut depth = 0;
+    let mut in_string = false;
+    let mut escaped = false;
+    for (i, c) in value.char_indices() {
+        if in_string {
+            match c {
+                _ if escaped => escaped = false,
+                '\\' => escaped = true,
+                '"' => in_string = false,
+                _ => {}
+            }
+            continue;
+        }
+        match c {
+            '"' => in_string = true,
+            '{' => depth += 1,
+            '}' => depth -= 1,
+            ',' if depth == 0 => return i,
+            _ => {}
+        }
+    }
+    value.len()
+}
+
+fn c_string(literal: &str) -> String {
+    let inner = literal
+        .strip_prefix('"')
+        .and_then(|s| s.strip_suffix('"'))
+        .unwrap_or_else(|| panic!("expected a string literal in parser.c, got {}", literal));
+    let mut result = String::with_capacity(inner.len());
+    let mut chars = inner.chars();
+    while let Some(c) = chars.next() {
+        if c != '\\' {
+            result.push(c);
+            continue;
+        }
+        match chars.next() {
+            Some('n') => result.push('\n'),
+            Some('r') => result.push('\r'),
+            Some('t') => result.push('\t'),
+            Some('v') => result.push('\u{b}'),
+            Some('f') => result.push('\u{c}'),
+            Some('0') => result.push('\0'),
+            Some(other) => result.push(other),
+            None => {}
+        }
+    }
+    result
+}
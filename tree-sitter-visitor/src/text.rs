@@ -0,0 +1,61 @@
+//! Node text helpers for visitors that know the source they are visiting.
+
+use syn::{parse_quote, Generics, Lifetime, TraitItem};
+
+/// The lifetime of the text that `source()` returns, which the trait takes as a parameter so that
+/// node text outlives the borrow of the visitor. That is the first lifetime the trait declares, or
+/// `'src`, added if it declares none.
+pub fn source_lifetime(generics: &mut Generics) -> Lifetime {
+    if let Some(param) = generics.lifetimes().next() {
+        return param.lifetime.clone();
+    }
+    let lifetime: Lifetime = parse_quote!('src);
+    generics.params.insert(0, parse_quote!(#lifetime));
+    lifetime
+}
+
+/// The node text helpers provided on top of a required `source()`.
+pub fn source_fns(lifetime: &Lifetime) -> [TraitItem; 4] {
+    [
+        parse_quote! {
+            #[doc=r"The text that the visited tree was parsed from."]
+            fn source(&self) -> &#lifetime [u8];
+        },
+        parse_quote! {
+            #[doc=r"The bytes of `node` in `source()`."]
+            #[inline]
+            fn bytes(&self, node: &::tree_sitter::Node) -> &#lifetime [u8] {
+                &self.source()[node.byte_range()]
+            }
+        },
+        parse_quote! {
+            #[doc=r"The text of `node` in `source()`. Only the bytes of the node are checked to be"]
+            #[doc=r"valid UTF-8, which panics if they are not."]
+            #[inline]
+            fn text(&self, node: &::tree_sitter::Node) -> &#lifetime str {
+                match ::std::str::from_utf8(self.bytes(node)) {
+                    Ok(text) => text,
+                    Err(error) => panic!("text of {} is not valid UTF-8: {}", node.kind(), error),
+                }
+            }
+        },
+        parse_quote! {
+            #[doc=r"The text of `node` in `source()`, which is only checked to be valid UTF-8 in"]
+            #[doc=r"debug builds."]
+            #[doc=r""]
+            #[doc=r"# Safety"]
+            #[doc=r""]
+            #[doc=r"`source()` must be valid UTF-8, as it is if it came from a `str`."]
+            #[inline]
+            unsafe fn text_unchecked(&self, node: &::tree_sitter::Node) -> &#lifetime str {
+                let bytes = self.bytes(node);
+                debug_assert!(
+                    ::std::str::from_utf8(bytes).is_ok(),
+                    "text of {} is not valid UTF-8",
+                    node.kind()
+                );
+                ::std::str::from_utf8_unchecked(bytes)
+            }
+        },
+    ]
+}
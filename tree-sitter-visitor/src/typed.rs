@@ -0,0 +1,482 @@
+//! Generates typed wrappers around `tree_sitter::Node` for the `typed` option.
+//!
+//! Every named node type gets a `#[repr(transparent)]` newtype, and every supertype and every set
+//! of types a field can hold gets an enum over those newtypes. Converting between them is checked
+//! once, when a node is cast, so code that receives a wrapper knows its kind statically.
+
+use crate::accessors::{child_lookup, children_lookup};
+use crate::dispatch::Kinds;
+use crate::node_types::{Field, Node, TypeRef};
+use crate::{camel_case, method_stem, rust_ident, sanitize_identifier};
+use proc_macro2::{Ident, TokenStream};
+use quote::{format_ident, quote};
+use std::collections::{BTreeMap, BTreeSet};
+
+pub struct Typed<'a> {
+    nodes: &'a [Node],
+    kinds: Kinds<'a>,
+    /// Hidden choice rules from `grammar.json`, used to name the enums of field types.
+    rules: BTreeMap<String, BTreeSet<String>>,
+    /// Enums over sets of node types, keyed by their sorted members.
+    enums: BTreeMap<Vec<String>, Ident>,
+    taken: BTreeSet<String>,
+}
+
+impl<'a> Typed<'a> {
+    pub fn new(
+        nodes: &'a [Node],
+        kinds: Kinds<'a>,
+        rules: BTreeMap<String, BTreeSet<String>>,
+    ) -> Self {
+        let mut typed = Typed {
+            nodes,
+            kinds,
+            rules,
+            enums: BTreeMap::new(),
+            taken: BTreeSet::new(),
+        };
+        for node in nodes.iter().filter(|node| node.named) {
+            typed.taken.insert(type_name(&node.r#type));
+        }
+        for node in nodes.iter().filter(|node| node.is_supertype()) {
+            if let Some(members) = named_members(&node.subtypes) {
+                typed
+                    .enums
+                    .insert(members, format_ident!("{}", type_name(&node.r#type)));
+            }
+        }
+        typed
+    }
+
+    /// The wrapper that the visitor methods of a node type take instead of `&Node`, if any.
+    ///
+    /// Anonymous nodes have no wrapper, and neither do supertypes with anonymous subtypes.
+    pub fn wrapper(&self, node: &Node) -> Option<Ident> {
+        if !node.named || (node.is_supertype() && named_members(&node.subtypes).is_none()) {
+            return None;
+        }
+        Some(format_ident!("{}", type_name(&node.r#type)))
+    }
+
+    /// Generates the wrappers and enums into the support module. `generics` are the generics of
+    /// their `accept` methods, which take a `V` implementing the visitor trait.
+    pub fn generate(mut self, generics: &TokenStream) -> TokenStream {
+        let nodes = self.nodes;
+        let structs: Vec<_> = nodes
+            .iter()
+            .filter(|node| node.named && !node.is_supertype())
+            .map(|node| self.wrapper_struct(node, generics))
+            .collect();
+
+        let supertypes: Vec<_> = self
+            .nodes
+            .iter()
+            .filter(|node| node.is_supertype())
+            .filter_map(|node| {
+                let ident = self.wrapper(node)?;
+                let doc = format!("A node of one of the subtypes of `{}`.", node.r#type);
+                let visit_method = format_ident!("visit_{}", method_stem(&node.r#type));
+                Some(self.wrapper_enum(&ident, &doc, &node.subtypes, generics, Some(visit_method)))
+            })
+            .collect();
+
+        // Field enums are only known once all the structs are generated, and do not dispatch to a
+        // method of their own; they forward to the wrapper they hold.
+        let supertype_idents: BTreeSet<_> = self
+            .nodes
+            .iter()
+            .filter_map(|node| node.is_supertype().then(|| self.wrapper(node)).flatten())
+            .collect();
+        let field_enums: Vec<_> = self
+            .enums
+            .clone()
+            .into_iter()
+            .filter(|(_, ident)| !supertype_idents.contains(ident))
+            .map(|(members, ident)| {
+                let types: Vec<_> = members
+                    .iter()
+                    .map(|member| TypeRef {
+                        r#type: member.clone(),
+                        named: true,
+                    })
+                    .collect();
+                let doc = format!("A node of one of the types `{}`.", members.join("`, `"));
+                self.wrapper_enum(&ident, &doc, &types, generics, None)
+            })
+            .collect();
+
+        quote! {
+            #(#structs)*
+            #(#supertypes)*
+            #(#field_enums)*
+        }
+    }
+
+    fn wrapper_struct(&mut self, node: &Node, generics: &TokenStream) -> TokenStream {
+        let ident = format_ident!("{}", type_name(&node.r#type));
+        let visit_method = format_ident!("visit_{}", method_stem(&node.r#type));
+        let doc = format!("A node of type `{}`.", node.r#type);
+        let cast_doc = format!("Wraps `node` if it is of type `{}`.", node.r#type);
+        let subject = self.kinds.subject(quote! { node });
+        let cast = match self.kinds.pattern(node) {
+            Some(pattern) => quote! {
+                match #subject {
+                    #pattern => Some(#ident(node)),
+                    _ => None,
+                }
+            },
+            None => quote! {
+                let _ = node;
+                None
+            },
+        };
+
+        let by_id = self.kinds.by_id();
+        let mut accessors = Vec::new();
+        for (field_name, field) in &node.fields {
+            let method = rust_ident(&sanitize_identifier(field_name));
+            let item = self.item_type(&node.r#type, field_name, field);
+            if field.multiple {
+                let doc = format!("Iterates over the `{}` children.", field_name);
+                let lookup = children_lookup(by_id, quote! { self.0 }, field_name);
+                let (item_type, convert) = item.typed_iter();
+                accessors.push(quote! {
+                    #[doc=#doc]
+                    #[inline]
+                    pub fn #method<'cursor>(
+                        &self,
+                        cursor: &'cursor mut ::tree_sitter::TreeCursor<'tree>,
+                    ) -> impl Iterator<Item = #item_type> + 'cursor {
+                        #lookup #convert
+                    }
+                });
+            } else {
+                let doc = format!("Returns the `{}` child.", field_name);
+                let lookup = child_lookup(by_id, quote! { self.0 }, field_name);
+                let (item_type, convert) = item.typed_option();
+                accessors.push(quote! {
+                    #[doc=#doc]
+                    #[inline]
+                    pub fn #method(&self) -> Option<#item_type> {
+                        #lookup #convert
+                    }
+                });
+            }
+        }
+        if let Some(children) = &node.children {
+            let item = self.item_type(&node.r#type, "children", children);
+            let (item_type, convert) = item.typed_iter();
+            accessors.push(quote! {
+                #[doc=r"Iterates over the named children that are not in a field."]
+                pub fn typed_children<'cursor>(
+                    &self,
+                    cursor: &'cursor mut ::tree_sitter::TreeCursor<'tree>,
+                ) -> impl Iterator<Item = #item_type> + 'cursor {
+                    cursor.reset(self.0);
+                    let mut more = cursor.goto_first_child();
+                    ::std::iter::from_fn(move || {
+                        while more {
+                            let node = cursor.node();
+                            let field = cursor.field_id();
+                            more = cursor.goto_next_sibling();
+                            if node.is_named() && !node.is_extra() && field.is_none() {
+                                return Some(node);
+                            }
+                        }
+                        None
+                    })
+                    #convert
+                }
+            });
+            if !children.multiple {
+                accessors.push(quote! {
+                    #[doc=r"Returns the named child that is not in a field."]
+                    pub fn typed_child(
+                        &self,
+                        cursor: &mut ::tree_sitter::TreeCursor<'tree>,
+                    ) -> Option<#item_type> {
+                        self.typed_children(cursor).next()
+                    }
+                });
+            }
+        }
+
+        quote! {
+            #[doc=#doc]
+            #[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+            #[repr(transparent)]
+            pub struct #ident<'tree>(::tree_sitter::Node<'tree>);
+
+            impl<'tree> #ident<'tree> {
+                #[doc=#cast_doc]
+                #[inline]
+                pub fn cast(node: ::tree_sitter::Node<'tree>) -> Option<Self> {
+                    #cast
+                }
+
+                #[doc(hidden)]
+                #[inline]
+                pub fn from_node_unchecked(node: ::tree_sitter::Node<'tree>) -> Self {
+                    #ident(node)
+                }
+
+                #[doc=r"Returns the wrapped node."]
+                #[inline]
+                pub fn node(&self) -> ::tree_sitter::Node<'tree> {
+                    self.0
+                }
+
+                #[doc=r"Calls the visitor method for this node type."]
+                #[inline]
+                pub fn accept #generics (self, visitor: &mut V) -> V::ReturnType {
+                    visitor.#visit_method(self)
+                }
+
+                #(#accessors)*
+            }
+
+            impl<'tree> ::std::ops::Deref for #ident<'tree> {
+                type Target = ::tree_sitter::Node<'tree>;
+
+                #[inline]
+                fn deref(&self) -> &Self::Target {
+                    &self.0
+                }
+            }
+
+            impl<'tree> From<#ident<'tree>> for ::tree_sitter::Node<'tree> {
+                #[inline]
+                fn from(node: #ident<'tree>) -> Self {
+                    node.0
+                }
+            }
+        }
+    }
+
+    fn wrapper_enum(
+        &self,
+        ident: &Ident,
+        doc: &str,
+        members: &[TypeRef],
+        generics: &TokenStream,
+        visit_method: Option<Ident>,
+    ) -> TokenStream {
+        let by_name: BTreeMap<_, _> = self.nodes.iter().map(|n| (&n.r#type, n)).collect();
+        let members: Vec<_> = members
+            .iter()
+            .filter_map(|member| by_name.get(&member.r#type).copied())
+            .collect();
+        let variants: Vec<_> = members
+            .iter()
+            .map(|member| format_ident!("{}", type_name(&member.r#type)))
+            .collect();
+
+        let subject = self.kinds.subject(quote! { node });
+        let concrete = members
+            .iter()
+            .zip(&variants)
+            .filter(|(member, _)| !member.is_supertype())
+            .filter_map(|(member, variant)| {
+                let pattern = self.kinds.pattern(member)?;
+                Some(quote! { #pattern => return Some(Self::#variant(#variant(node))) })
+            });
+        let nested = members
+            .iter()
+            .zip(&variants)
+            .filter(|(member, _)| member.is_supertype())
+            .map(|(_, variant)| {
+                quote! {
+                    if let Some(node) = #variant::cast(node) {
+                        return Some(Self::#variant(node));
+                    }
+                }
+            });
+
+        // Supertypes have a visitor method of their own that defaults to `accept`, so that a
+        // visitor can override how a whole group of node types is handled.
+        let accept = match visit_method {
+            Some(visit_method) => quote! { visitor.#visit_method(self) },
+            None => quote! { self.dispatch(visitor) },
+        };
+
+        quote! {
+            #[doc=#doc]
+            #[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+            pub enum #ident<'tree> {
+                #(#variants(#variants<'tree>),)*
+            }
+
+            impl<'tree> #ident<'tree> {
+                #[doc=r"Wraps `node` if it is of one of the member types."]
+                #[inline]
+                pub fn cast(node: ::tree_sitter::Node<'tree>) -> Option<Self> {
+                    match #subject {
+                        #(#concrete,)*
+                        _ => {}
+                    }
+                    #(#nested)*
+                    None
+                }
+
+                #[doc=r"Returns the wrapped node."]
+                #[inline]
+                pub fn node(&self) -> ::tree_sitter::Node<'tree> {
+                    match self {
+                        #(Self::#variants(node) => node.node(),)*
+                    }
+                }
+
+                #[doc=r"Calls the visitor method for this node."]
+                #[inline]
+                pub fn accept #generics (self, visitor: &mut V) -> V::ReturnType {
+                    #accept
+                }
+
+                #[doc=r"Calls the visitor method for the type of node this actually is."]
+                #[inline]
+                pub fn dispatch #generics (self, visitor: &mut V) -> V::ReturnType {
+                    match self {
+                        #(Self::#variants(node) => node.accept(visitor),)*
+                    }
+                }
+            }
+
+            impl<'tree> ::std::ops::Deref for #ident<'tree> {
+                type Target = ::tree_sitter::Node<'tree>;
+
+                #[inline]
+                fn deref(&self) -> &Self::Target {
+                    match self {
+                        #(Self::#variants(node) => node,)*
+                    }
+                }
+            }
+
+            impl<'tree> From<#ident<'tree>> for ::tree_sitter::Node<'tree> {
+                #[inline]
+                fn from(node: #ident<'tree>) -> Self {
+                    node.node()
+                }
+            }
+        }
+    }
+
+    /// Works out the Rust type of the children in a field.
+    fn item_type(&mut self, owner: &str, field_name: &str, field: &Field) -> ItemType {
+        let members = match named_members(&field.types) {
+            Some(members) => members,
+            None => return ItemType::Node,
+        };
+        if let [single] = &members[..] {
+            return ItemType::Wrapper(format_ident!("{}", type_name(single)));
+        }
+        if let Some(ident) = self.enums.get(&members) {
+            return ItemType::Wrapper(ident.clone());
+        }
+
+        let set: BTreeSet<_> = members.iter().cloned().collect();
+        let rule_name = self
+            .rules
+            .iter()
+            .find(|(_, rule)| **rule == set)
+            .map(|(name, _)| type_name(name))
+            .filter(|name| !self.taken.contains(name));
+        let name = rule_name.unwrap_or_else(|| type_name(&format!("{}_{}", owner, field_name)));
+        self.taken.insert(name.clone());
+
+        let ident = format_ident!("{}", name);
+        self.enums.insert(members, ident.clone());
+        ItemType::Wrapper(ident)
+    }
+}
+
+enum ItemType {
+    Node,
+    Wrapper(Ident),
+}
+
+impl ItemType {
+    fn typed_option(&self) -> (TokenStream, TokenStream) {
+        match self {
+            ItemType::Node => (quote! { ::tree_sitter::Node<'tree> }, quote! {}),
+            ItemType::Wrapper(ident) => {
+                (quote! { #ident<'tree> }, quote! { .and_then(#ident::cast) })
+            }
+        }
+    }
+
+    fn typed_iter(&self) -> (TokenStream, TokenStream) {
+        match self {
+            ItemType::Node => (quote! { ::tree_sitter::Node<'tree> }, quote! {}),
+            ItemType::Wrapper(ident) => (
+                quote! { #ident<'tree> },
+                quote! { .filter_map(#ident::cast) },
+            ),
+        }
+    }
+}
+
+/// Names that the support module uses unqualified: `Self` and the standard prelude.
+const SHADOWED: [&str; 39] = [
+    "Self",
+    "AsMut",
+    "AsRef",
+    "Box",
+    "Clone",
+    "Copy",
+    "Default",
+    "DoubleEndedIterator",
+    "Drop",
+    "Eq",
+    "Err",
+    "ExactSizeIterator",
+    "Extend",
+    "Fn",
+    "FnMut",
+    "FnOnce",
+    "From",
+    "FromIterator",
+    "Into",
+    "IntoIterator",
+    "Iterator",
+    "None",
+    "Ok",
+    "Option",
+    "Ord",
+    "PartialEq",
+    "PartialOrd",
+    "Result",
+    "Send",
+    "Sized",
+    "Some",
+    "String",
+    "Sync",
+    "ToOwned",
+    "ToString",
+    "TryFrom",
+    "TryInto",
+    "Unpin",
+    "Vec",
+];
+
+/// The name of the wrapper or enum for a node type or rule, `AddExpr` for `add_expr`. Names that
+/// would shadow one of `SHADOWED` get a trailing underscore, like `Self_` for a `self` type.
+fn type_name(name: &str) -> String {
+    let name = camel_case(name);
+    if SHADOWED.contains(&name.as_str()) {
+        name + "_"
+    } else {
+        name
+    }
+}
+
+/// Sorted names of the given types, `None` if any of them is anonymous and has no wrapper.
+fn named_members(types: &[TypeRef]) -> Option<Vec<String>> {
+    let mut members = types
+        .iter()
+        .map(|t| t.named.then(|| t.r#type.clone()))
+        .collect::<Option<Vec<_>>>()?;
+    members.sort();
+    members.dedup();
+    Some(members)
+}